@@ -0,0 +1,362 @@
+#include "Benchmark.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "Matrix.h"
+#include "CrystalModel.h"
+#include "random.h"
+
+/* Steps per walk between two relaunches in Benchmark_layouts. */
+#define LAYOUT_WALK_STEPS 4096
+#define LAYOUT_WALKS 4096
+
+/* Outcome of one crystal grown by Benchmark_growth. */
+typedef struct
+{
+  double wall;
+  uint64_t ions;
+  uint64_t steps;
+  uint64_t escapes;
+  long peak_rss_kb;
+} GrowthRun;
+
+static char const *const kernel_names[] = { "scalar", "batch", "integer" };
+static char const *const launch_names[] = { "fixed", "adaptive" };
+static char const *const escape_names[] = { "relaunch", "return" };
+static char const *const layout_names[] = { "bytes", "bits", "tiled", "sparse" };
+
+static void
+grow(BenchmarkConfig const *config,
+     size_t size,
+     uint64_t seed,
+     GrowthRun *run)
+{
+  unsigned r_start = size/2;
+  unsigned r_escape = 11 * r_start / 10;
+  Matrix *bath = Matrix_create_with_layout(2 * (r_escape + 2), config->layout);
+  CrystalModel *cm = CrystalModel_create(bath, r_start, r_escape);
+  double t0;
+
+  CrystalModel_set_long_jumps(cm, config->long_jumps);
+  CrystalModel_set_launch_mode(cm, config->launch_mode);
+  CrystalModel_set_escape_mode(cm, config->escape_mode);
+  CrystalModel_set_kernel(cm, config->kernel);
+  CrystalModel_srand(cm, seed);
+  t0 = crystal_time();
+  CrystalModel_run_parallel(cm, UINT_MAX, config->threads);
+  run->wall = crystal_time() - t0;
+  run->ions = CrystalModel_get_ions(cm);
+  run->steps = CrystalModel_get_steps(cm);
+  run->escapes = CrystalModel_get_escapes(cm);
+  CrystalModel_destroy(cm);
+  Matrix_destroy(bath);
+}
+
+/* Grows in a child process, whose peak RSS is only that of this run. */
+static int
+grow_forked(BenchmarkConfig const *config,
+	    size_t size,
+	    uint64_t seed,
+	    GrowthRun *run)
+{
+  struct rusage usage;
+  int fds[2], status;
+  pid_t pid;
+  ssize_t got;
+
+  if (pipe(fds)) {
+    return -1;
+  }
+  fflush(NULL);
+  pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    grow(config, size, seed, run);
+    _exit(write(fds[1], run, sizeof(*run)) == sizeof(*run) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return -1;
+  }
+  got = read(fds[0], run, sizeof(*run));
+  close(fds[0]);
+  if (wait4(pid, &status, 0, &usage) < 0 || got != sizeof(*run) ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    return -1;
+  }
+  run->peak_rss_kb = usage.ru_maxrss;
+  return 0;
+}
+
+static int
+compare_doubles(void const *a,
+		void const *b)
+{
+  double const x = *(double const *)a, y = *(double const *)b;
+  return (x > y) - (x < y);
+}
+
+/* Sorts the n samples in place. */
+static double
+median(double *samples,
+       unsigned n)
+{
+  qsort(samples, n, sizeof(double), compare_doubles);
+  return n % 2 ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2;
+}
+
+static void
+run_kernel(size_t size,
+	   uint64_t seed,
+	   CrystalKernel kernel,
+	   MatrixLayout layout,
+	   CrystalRule rule,
+	   double param,
+	   char const *name,
+	   FILE *out)
+{
+  unsigned r_start = size/2;
+  unsigned r_escape = 11 * r_start / 10;
+  Matrix *bath = Matrix_create_with_layout(2 * (r_escape + 2), layout);
+  CrystalModel *cm = CrystalModel_create(bath, r_start, r_escape);
+  double t0, t1;
+
+  CrystalModel_set_kernel(cm, kernel);
+  if (rule != CRYSTAL_RULE_DLA) {
+    CrystalModel_set_rule(cm, rule, param);
+  }
+  CrystalModel_srand(cm, seed);
+  t0 = crystal_time();
+  while (CrystalModel_crystallize_one_ion(cm)) {
+  }
+  t1 = crystal_time();
+  fprintf(out, "%-12s %8zu %10" PRIu64 " %14" PRIu64 " %10.3f %14.0f\n",
+	  name, size, CrystalModel_get_ions(cm), CrystalModel_get_steps(cm), t1-t0,
+	  CrystalModel_get_steps(cm) / (t1-t0));
+  CrystalModel_destroy(cm);
+  Matrix_destroy(bath);
+}
+
+extern void
+Benchmark_kernels(size_t size,
+		  uint64_t seed,
+		  FILE *out)
+{
+  fprintf(out, "%-12s %8s %10s %14s %10s %14s\n",
+	  "kernel", "size", "ions", "steps", "time [s]", "steps/s");
+  run_kernel(size, seed, CRYSTAL_KERNEL_SCALAR, MATRIX_LAYOUT_BYTES, CRYSTAL_RULE_DLA, 0,
+	     "scalar", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_SCALAR, MATRIX_LAYOUT_BITS, CRYSTAL_RULE_DLA, 0,
+	     "scalar/bits", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_INTEGER, MATRIX_LAYOUT_BYTES, CRYSTAL_RULE_DLA, 0,
+	     "integer", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_INTEGER, MATRIX_LAYOUT_BITS, CRYSTAL_RULE_DLA, 0,
+	     "integer/bits", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_BATCH, MATRIX_LAYOUT_BYTES, CRYSTAL_RULE_DLA, 0,
+	     "batch", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_BATCH, MATRIX_LAYOUT_BITS, CRYSTAL_RULE_DLA, 0,
+	     "batch/bits", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_SCALAR, MATRIX_LAYOUT_BYTES, CRYSTAL_RULE_STICKY, 0.5,
+	     "sticky/0.5", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_SCALAR, MATRIX_LAYOUT_BYTES, CRYSTAL_RULE_NOISE, 4,
+	     "noise/4", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_SCALAR, MATRIX_LAYOUT_BYTES, CRYSTAL_RULE_BALLISTIC, 0,
+	     "ballistic", out);
+  run_kernel(size, seed, CRYSTAL_KERNEL_SCALAR, MATRIX_LAYOUT_BYTES, CRYSTAL_RULE_EDEN, 0,
+	     "eden", out);
+}
+
+extern void
+Benchmark_threads(size_t size,
+		  uint64_t seed,
+		  unsigned max_threads,
+		  FILE *out)
+{
+  unsigned r_start = size/2;
+  unsigned r_escape = 11 * r_start / 10;
+  Matrix *bath = Matrix_create(2 * (r_escape + 2));
+  CrystalModel *cm = CrystalModel_create(bath, r_start, r_escape);
+  double t0, t1, t_serial = 0;
+
+  fprintf(out, "%-8s %8s %10s %10s %10s %10s\n",
+	  "threads", "size", "ions", "retries", "time [s]", "speedup");
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    CrystalModel_reset(cm);
+    CrystalModel_srand(cm, seed);
+    t0 = crystal_time();
+    if (threads == 1) {
+      while (CrystalModel_crystallize_one_ion(cm)) {
+      }
+    } else {
+      CrystalModel_run_parallel(cm, UINT_MAX, threads);
+    }
+    t1 = crystal_time();
+    if (threads == 1) {
+      t_serial = t1-t0;
+    }
+    fprintf(out, "%-8u %8zu %10" PRIu64 " %10" PRIu64 " %10.3f %10.2f\n",
+	    threads, size, CrystalModel_get_ions(cm), CrystalModel_get_retries(cm),
+	    t1-t0, t_serial / (t1-t0));
+  }
+  CrystalModel_destroy(cm);
+  Matrix_destroy(bath);
+}
+
+static double
+walk_layout(Matrix *mat,
+	    uint64_t seed,
+	    unsigned *hits)
+{
+  unsigned const size = Matrix_size(mat);
+  int const dx[] = { 1, -1, 0, 0 };
+  int const dy[] = { 0, 0, 1, -1 };
+  CsRandom rng;
+  unsigned x, y, nx, ny;
+  double t0;
+
+  cs_rand_seed(&rng, seed);
+  t0 = crystal_time();
+  for (unsigned walk = 0; walk < LAYOUT_WALKS; ++walk) {
+    uint64_t r = cs_rand(&rng);
+    x = 1 + (uint32_t)r % (size - 2);
+    y = 1 + (uint32_t)(r >> 32) % (size - 2);
+    for (unsigned step = 0; step < LAYOUT_WALK_STEPS; step += 32) {
+      uint64_t dirs = cs_rand(&rng);
+      for (int k = 0; k < 32; ++k, dirs >>= 2) {
+	*hits += (Matrix_get(mat, x+1, y) | Matrix_get(mat, x-1, y) |
+		  Matrix_get(mat, x, y+1) | Matrix_get(mat, x, y-1));
+	/* Steps off the interior are reflected. */
+	nx = x + dx[dirs & 3];
+	ny = y + dy[dirs & 3];
+	x = nx - 1 < size - 2 ? nx : 2*x - nx;
+	y = ny - 1 < size - 2 ? ny : 2*y - ny;
+      }
+    }
+  }
+  return (crystal_time() - t0) * 1e9 / ((double)LAYOUT_WALKS * LAYOUT_WALK_STEPS);
+}
+
+extern void
+Benchmark_layouts(uint64_t seed,
+		  FILE *out)
+{
+  static unsigned const sizes[] = { 1024, 4096, 16384 };
+  static struct { MatrixLayout layout; char const *name; } const layouts[] = {
+    { MATRIX_LAYOUT_BYTES, "bytes" },
+    { MATRIX_LAYOUT_TILED, "tiled" },
+    { MATRIX_LAYOUT_BITS, "bits" },
+    { MATRIX_LAYOUT_SPARSE, "sparse" },
+  };
+  unsigned hits = 0;
+
+  fprintf(out, "%-8s %8s %12s\n", "layout", "size", "ns/step");
+  for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i) {
+    for (size_t j = 0; j < sizeof(layouts)/sizeof(layouts[0]); ++j) {
+      Matrix *mat = Matrix_create_with_layout(sizes[i], layouts[j].layout);
+      /* A sparse pattern keeps pages resident and the loads honest. */
+      for (unsigned y = 0; y < sizes[i]; y += 7) {
+	for (unsigned x = y % 13; x < sizes[i]; x += 13) {
+	  Matrix_set(mat, x, y, 1);
+	}
+      }
+      fprintf(out, "%-8s %8u %12.2f\n", layouts[j].name, sizes[i],
+	      walk_layout(mat, seed, &hits));
+      Matrix_destroy(mat);
+    }
+  }
+  fprintf(out, "(%u occupied neighbourhoods)\n", hits);
+}
+
+extern int
+Benchmark_growth(BenchmarkConfig const *config,
+		 size_t const *sizes,
+		 size_t n_sizes,
+		 unsigned repetitions,
+		 uint64_t seed,
+		 BenchmarkFormat format,
+		 FILE *out)
+{
+  enum { WALL, IONS_PER_S, STEPS_PER_S, RELAUNCHES_PER_ION, PEAK_RSS, METRICS };
+  double *samples = (double *)malloc(METRICS * repetitions * sizeof(double));
+  double m[METRICS];
+  GrowthRun run;
+  int ret = 0;
+
+  switch (format) {
+  case BENCHMARK_JSON:
+    fprintf(out, "{\n  \"seed\": %" PRIu64 ",\n  \"repetitions\": %u,\n"
+	    "  \"kernel\": \"%s\",\n  \"launch\": \"%s\",\n  \"escape\": \"%s\",\n"
+	    "  \"jumps\": %d,\n  \"bath\": \"%s\",\n  \"threads\": %u,\n  \"results\": [",
+	    seed, repetitions, kernel_names[config->kernel], launch_names[config->launch_mode],
+	    escape_names[config->escape_mode], config->long_jumps,
+	    layout_names[config->layout], config->threads);
+    break;
+  case BENCHMARK_CSV:
+    fprintf(out, "size,kernel,launch,escape,jumps,bath,threads,seed,repetitions,"
+	    "ions,steps,wall_s,ions_per_s,steps_per_s,relaunches_per_ion,peak_rss_kb\n");
+    break;
+  default:
+    fprintf(out, "%8s %10s %14s %10s %12s %14s %12s %12s\n", "size", "ions", "steps",
+	    "time [s]", "ions/s", "steps/s", "relaunch/ion", "peak RSS [kB]");
+    break;
+  }
+
+  for (size_t i = 0; i < n_sizes; ++i) {
+    for (unsigned rep = 0; rep < repetitions; ++rep) {
+      if (grow_forked(config, sizes[i], seed, &run)) {
+	fprintf(stderr, "benchmark: run of size %zu failed\n", sizes[i]);
+	ret = -1;
+	break;
+      }
+      samples[WALL*repetitions + rep] = run.wall;
+      samples[IONS_PER_S*repetitions + rep] = run.ions / run.wall;
+      samples[STEPS_PER_S*repetitions + rep] = run.steps / run.wall;
+      samples[RELAUNCHES_PER_ION*repetitions + rep] = (double)run.escapes / run.ions;
+      samples[PEAK_RSS*repetitions + rep] = run.peak_rss_kb;
+    }
+    if (ret) {
+      break;
+    }
+    for (int k = 0; k < METRICS; ++k) {
+      m[k] = median(samples + k*repetitions, repetitions);
+    }
+
+    /* Ion and step counts depend on the seed only, all runs agree. */
+    switch (format) {
+    case BENCHMARK_JSON:
+      fprintf(out, "%s\n    { \"size\": %zu, \"ions\": %" PRIu64 ", \"steps\": %" PRIu64
+	      ", \"wall_s\": %.6f, \"ions_per_s\": %.1f, \"steps_per_s\": %.1f"
+	      ", \"relaunches_per_ion\": %.4f, \"peak_rss_kb\": %.0f }",
+	      i ? "," : "", sizes[i], run.ions, run.steps,
+	      m[WALL], m[IONS_PER_S], m[STEPS_PER_S], m[RELAUNCHES_PER_ION], m[PEAK_RSS]);
+      break;
+    case BENCHMARK_CSV:
+      fprintf(out, "%zu,%s,%s,%s,%d,%s,%u,%" PRIu64 ",%u,%" PRIu64 ",%" PRIu64
+	      ",%.6f,%.1f,%.1f,%.4f,%.0f\n",
+	      sizes[i], kernel_names[config->kernel], launch_names[config->launch_mode],
+	      escape_names[config->escape_mode], config->long_jumps,
+	      layout_names[config->layout], config->threads, seed, repetitions,
+	      run.ions, run.steps,
+	      m[WALL], m[IONS_PER_S], m[STEPS_PER_S], m[RELAUNCHES_PER_ION], m[PEAK_RSS]);
+      break;
+    default:
+      fprintf(out, "%8zu %10" PRIu64 " %14" PRIu64 " %10.3f %12.0f %14.0f %12.3f %12.0f\n",
+	      sizes[i], run.ions, run.steps,
+	      m[WALL], m[IONS_PER_S], m[STEPS_PER_S], m[RELAUNCHES_PER_ION], m[PEAK_RSS]);
+      break;
+    }
+    fflush(out);
+  }
+
+  if (format == BENCHMARK_JSON) {
+    fprintf(out, "\n  ]\n}\n");
+  }
+  free(samples);
+  return ret;
+}
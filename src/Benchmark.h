@@ -0,0 +1,75 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "CrystalModel.h"
+#include "Matrix.h"
+
+typedef enum
+{
+  BENCHMARK_TEXT,
+  BENCHMARK_JSON,
+  BENCHMARK_CSV
+} BenchmarkFormat;
+
+/* Settings of the crystals grown by Benchmark_growth. */
+typedef struct
+{
+  int long_jumps;
+  CrystalLaunchMode launch_mode;
+  CrystalEscapeMode escape_mode;
+  CrystalKernel kernel;
+  MatrixLayout layout;
+  unsigned threads;
+} BenchmarkConfig;
+
+/*
+ * Grows a complete crystal from `seed` for each of the `n_sizes` sizes,
+ * `repetitions` times each, every run in a child process of its own so
+ * that its peak RSS can be told apart. Reports the medians of wall time,
+ * ions/s, walker steps/s, relaunches per ion and peak RSS per size.
+ * Returns 0 on success, -1 if a run failed.
+ */
+extern int
+Benchmark_growth(BenchmarkConfig const *config,
+		 size_t const *sizes,
+		 size_t n_sizes,
+		 unsigned repetitions,
+		 uint64_t seed,
+		 BenchmarkFormat format,
+		 FILE *out);
+
+/*
+ * Grows one crystal of the given size with every walker kernel and bath
+ * layout, then with every growth rule on the scalar kernel, from the same
+ * seed and reports walker steps per second for each. The scalar and
+ * integer kernels walk the same random streams to the same crystal.
+ */
+extern void
+Benchmark_kernels(size_t size,
+		  uint64_t seed,
+		  FILE *out);
+
+/*
+ * Grows one crystal with the speculative parallel engine for 1, 2, 4 ...
+ * up to `max_threads` threads and reports the speedup over one thread.
+ */
+extern void
+Benchmark_threads(size_t size,
+		  uint64_t seed,
+		  unsigned max_threads,
+		  FILE *out);
+
+/*
+ * Measures the cost of the neighbour lookups of a random walker for each
+ * Matrix layout at several bath sizes. The walker is moved to a random
+ * cell every few thousand steps, like a relaunched ion.
+ */
+extern void
+Benchmark_layouts(uint64_t seed,
+		  FILE *out);
+
+#endif //BENCHMARK_H_
@@ -0,0 +1,189 @@
+#include "Checkpoint.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* Ions grown between two looks at the clock. */
+#define CLOCK_IONS 256
+
+struct checkpoint_t
+{
+  char *_path;
+  char *_tmp_path;
+  unsigned _every_ions;
+  unsigned _every_seconds;
+  pid_t _writer;
+};
+
+static int
+begin_write(Checkpoint *self,
+	    CrystalModel const *cm);
+static int
+wait_writer(Checkpoint *self);
+static int
+write_file(Checkpoint const *self,
+	   CrystalModel const *cm);
+
+extern Checkpoint *
+Checkpoint_create(char const *path,
+		  unsigned every_ions,
+		  unsigned every_seconds)
+{
+  Checkpoint *self = (Checkpoint *)calloc(1, sizeof(Checkpoint));
+
+  self->_path = strdup(path);
+  self->_tmp_path = (char *)malloc(strlen(path) + 5);
+  strcpy(self->_tmp_path, path);
+  strcat(self->_tmp_path, ".tmp");
+  self->_every_ions = every_ions;
+  self->_every_seconds = every_seconds;
+  self->_writer = -1;
+  return self;
+}
+
+extern void
+Checkpoint_destroy(Checkpoint *self)
+{
+  if (!self) { return; }
+
+  wait_writer(self);
+  free(self->_path); self->_path = NULL;
+  free(self->_tmp_path); self->_tmp_path = NULL;
+  free(self);
+}
+
+extern int
+Checkpoint_run(Checkpoint *self,
+	       CrystalModel *cm,
+	       unsigned threads)
+{
+  double last = crystal_time();
+  uint64_t last_ions = CrystalModel_get_ions(cm);
+  unsigned chunk;
+  int growing = 1, failed = 0;
+
+  while (growing) {
+    chunk = CLOCK_IONS;
+    if (self->_every_ions) {
+      uint64_t const due = last_ions + self->_every_ions - CrystalModel_get_ions(cm);
+      if (due < chunk) {
+	chunk = (unsigned)due;
+      }
+    }
+    growing = CrystalModel_run_parallel(cm, chunk, threads);
+    if (growing &&
+	((self->_every_ions && CrystalModel_get_ions(cm) - last_ions >= self->_every_ions) ||
+	 (self->_every_seconds && crystal_time() - last >= self->_every_seconds))) {
+      failed |= begin_write(self, cm) != 0;
+      last = crystal_time();
+      last_ions = CrystalModel_get_ions(cm);
+    }
+  }
+  failed |= Checkpoint_write(self, cm) != 0;
+  return failed ? -1 : 0;
+}
+
+extern int
+Checkpoint_write(Checkpoint *self,
+		 CrystalModel const *cm)
+{
+  int const begun = begin_write(self, cm);
+  return wait_writer(self) || begun ? -1 : 0;
+}
+
+extern int
+Checkpoint_resume(CrystalModel *cm,
+		  char const *path)
+{
+  FILE *in = fopen(path, "rb");
+  int ret;
+
+  if (!in) {
+    perror(path);
+    return -1;
+  }
+  ret = CrystalModel_load(cm, in);
+  fclose(in);
+  if (!ret) {
+    fprintf(stderr, "checkpoint: resumed %s at %" PRIu64 " ions\n",
+	    path, CrystalModel_get_ions(cm));
+  }
+  return ret;
+}
+
+/*
+ * The child process gets a copy-on-write snapshot of the model and writes
+ * it while the parent carries on. Only one writer runs at a time, a new
+ * checkpoint waits for the previous one, whose failure is returned here.
+ */
+static int
+begin_write(Checkpoint *self,
+	    CrystalModel const *cm)
+{
+  int const previous = wait_writer(self);
+  double t0;
+
+  fflush(NULL);
+  t0 = crystal_time();
+  self->_writer = fork();
+  if (self->_writer == 0) {
+    _exit(write_file(self, cm) ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+  if (self->_writer < 0) {
+    perror("checkpoint: fork");
+    return write_file(self, cm) || previous ? -1 : 0;
+  }
+  fprintf(stderr, "checkpoint: %" PRIu64 " ions, simulation stalled %.3f ms\n",
+	  CrystalModel_get_ions(cm), (crystal_time() - t0) * 1e3);
+  return previous;
+}
+
+static int
+wait_writer(Checkpoint *self)
+{
+  int status;
+
+  if (self->_writer <= 0) {
+    return 0;
+  }
+  while (waitpid(self->_writer, &status, 0) < 0) {
+    if (errno != EINTR) {
+      self->_writer = -1;
+      return -1;
+    }
+  }
+  self->_writer = -1;
+  return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? 0 : -1;
+}
+
+/* Writes next to the checkpoint and renames, so a crash leaves the old one. */
+static int
+write_file(Checkpoint const *self,
+	   CrystalModel const *cm)
+{
+  double const t0 = crystal_time();
+  FILE *out = fopen(self->_tmp_path, "wb");
+  long size;
+
+  if (!out) {
+    perror(self->_tmp_path);
+    return -1;
+  }
+  if (CrystalModel_save(cm, out) || fflush(out) || fsync(fileno(out))) {
+    perror(self->_tmp_path);
+    fclose(out);
+    return -1;
+  }
+  size = ftell(out);
+  if (fclose(out) || rename(self->_tmp_path, self->_path)) {
+    perror(self->_path);
+    return -1;
+  }
+  fprintf(stderr, "checkpoint: wrote %s, %ld bytes in %.3f s\n",
+	  self->_path, size, crystal_time() - t0);
+  return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include "CrystalModel.h"
+
+typedef struct checkpoint_t Checkpoint;
+
+/*
+ * Checkpoints are written to `path` every `every_ions` ions or every
+ * `every_seconds` seconds, whichever comes first; 0 disables either.
+ */
+extern Checkpoint *
+Checkpoint_create(char const *path,
+		  unsigned every_ions,
+		  unsigned every_seconds);
+/* Waits for a checkpoint still being written. */
+extern void
+Checkpoint_destroy(Checkpoint *self);
+
+/*
+ * Grows the crystal to completion like CrystalModel_run_parallel,
+ * writing checkpoints along the way and a last one at the end.
+ * Checkpoints are written by a forked copy of the process, so the
+ * simulation only stalls for the fork. Returns -1 if any of them
+ * failed, the run still goes on to the end.
+ */
+extern int
+Checkpoint_run(Checkpoint *self,
+	       CrystalModel *cm,
+	       unsigned threads);
+
+/* Writes a checkpoint of `cm` right away and waits for it. */
+extern int
+Checkpoint_write(Checkpoint *self,
+		 CrystalModel const *cm);
+
+/* Continues `cm` from the checkpoint at `path`. */
+extern int
+Checkpoint_resume(CrystalModel *cm,
+		  char const *path);
+
+#endif //CHECKPOINT_H_
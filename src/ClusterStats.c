@@ -0,0 +1,36 @@
+#include "ClusterStats.h"
+
+/* Width of the longest histogram bar. */
+#define BAR_WIDTH 40
+
+extern void
+ClusterStats_print(ClusterStats const *self,
+		   FILE *out)
+{
+  uint64_t const total = self->ions ? self->ions : 1;
+
+  fprintf(out, "ions %" PRIu64 ", centre of mass (%.2f, %.2f), radius of gyration %.2f"
+	  ", radius %u, fractal dimension %.3f\n",
+	  self->ions, self->centre_x, self->centre_y, self->rg, self->r_max,
+	  self->fractal_dimension);
+  fprintf(out, "mass within radius:\n");
+  for (int i = 0; i < CLUSTER_STATS_BINS; ++i) {
+    fprintf(out, "  <= %10u %10" PRIu64 " ", (i + 1) * self->radius_bin, self->mass[i]);
+    for (uint64_t k = 0; k < self->mass[i] * BAR_WIDTH / total; ++k) {
+      putc('#', out);
+    }
+    putc('\n', out);
+    if (self->mass[i] == self->ions) {
+      break;
+    }
+  }
+}
+
+extern void
+ClusterStats_summary(ClusterStats const *self,
+		     char *buf,
+		     size_t size)
+{
+  snprintf(buf, size, "Rg %.1f  radius %u  fractal dimension %.3f",
+	   self->rg, self->r_max, self->fractal_dimension);
+}
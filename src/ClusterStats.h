@@ -0,0 +1,40 @@
+#ifndef CLUSTERSTATS_H_
+#define CLUSTERSTATS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/* Number of bins of the mass-radius histogram. */
+#define CLUSTER_STATS_BINS 32
+
+/*
+ * Shape of the crystal, from sums the model updates as ions stick.
+ * Lengths are in lattice units, positions relative to the seed.
+ */
+typedef struct
+{
+  uint64_t ions;            /* occupied cells */
+  double centre_x;          /* centre of mass */
+  double centre_y;
+  double rg;                /* radius of gyration about the centre of mass */
+  unsigned r_max;
+  /* Slope of log mass over log radius, 0 while the crystal is too small. */
+  double fractal_dimension;
+  /* Ions within (i+1) radius_bin lattice units of the seed. */
+  unsigned radius_bin;
+  uint64_t mass[CLUSTER_STATS_BINS];
+} ClusterStats;
+
+/* Writes the shape and the mass-radius histogram, several lines. */
+extern void
+ClusterStats_print(ClusterStats const *self,
+		   FILE *out);
+
+/* Writes the shape as one line into `buf`. */
+extern void
+ClusterStats_summary(ClusterStats const *self,
+		     char *buf,
+		     size_t size);
+
+#endif //CLUSTERSTATS_H_
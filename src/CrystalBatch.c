@@ -0,0 +1,284 @@
+#include "CrystalModelPrivate.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*
+ * Batched kernel: BATCH_LANES walkers are in flight at the same time and
+ * advance in lockstep. Each round every lane is classified as escaped,
+ * sticky or free. Events are then handled in lane order, and at most one
+ * ion is committed per call, so the growth sequence is fully determined
+ * by the seed. A lane may only stick if its cell is still empty in the
+ * Matrix, otherwise its walker is relaunched.
+ */
+
+static int
+linear_lanes(CrystalModel const *self);
+static void
+launch_lane(CrystalModel *self,
+	    int lane);
+static void
+place_lane(CrystalModel *self,
+	   int lane,
+	   Point const *p);
+static unsigned
+classify(CrystalModel const *self,
+	 unsigned *escaped);
+static unsigned
+classify_linear(CrystalModel const *self,
+		unsigned *escaped);
+static void
+step_lanes(CrystalModel *self);
+
+extern int
+crystal_batch_crystallize_one_ion(CrystalModel *self)
+{
+  CrystalWalker *w = &self->_walker;
+  unsigned sticky, escaped;
+  uint64_t check = self->_limit ? self->_steps + CRYSTAL_CHECK_STEPS : UINT64_MAX;
+  Point p;
+  CRYSTAL_STAT(double const t0 = crystal_time());
+
+  w->r_launch = self->_r_launch;
+  w->r_kill = self->_r_kill;
+  if (!self->_batch.live) {
+    for (int lane = 0; lane < BATCH_LANES; ++lane) {
+      launch_lane(self, lane);
+    }
+    self->_batch.live = 1;
+  }
+  for (;;) {
+    sticky = classify(self, &escaped);
+    if (!(sticky | escaped)) {
+      step_lanes(self);
+      /* The lanes stay in flight, the next call continues them. */
+      if (self->_steps >= check) {
+	if (crystal_limit_reached(self, self->_steps)) {
+	  CRYSTAL_STAT(w->seconds += crystal_time() - t0);
+	  return 1;
+	}
+	check += CRYSTAL_CHECK_STEPS;
+      }
+      continue;
+    }
+    for (int lane = 0; lane < BATCH_LANES; ++lane) {
+      p.x = self->_batch.x[lane];
+      p.y = self->_batch.y[lane];
+      if (escaped & (1u << lane)) {
+	crystal_escape(self, w, &p);
+	self->_escapes++;
+	CRYSTAL_STAT(self->_batch.escapes[lane]++);
+	place_lane(self, lane, &p);
+      } else if (sticky & (1u << lane)) {
+	if (!CrystalModel_get_model_value(self, p.x, p.y)) {
+	  self->_p = p;
+	  crystal_stick_ion(self, p.x, p.y);
+#ifdef CRYSTAL_STATS
+	  {
+	    /* All lanes step together, and are classified once per step. */
+	    uint64_t const steps = (self->_steps - self->_batch.launch_steps[lane]) / BATCH_LANES;
+	    crystal_stats_record(&self->_stats, steps, self->_batch.escapes[lane], steps + 1, &p,
+				 w->seconds + crystal_time() - t0);
+	    w->seconds = 0;
+	  }
+#endif
+	  launch_lane(self, lane);
+	  return !crystal_outside_circle(self->_r_start, &self->_p);
+	}
+	launch_lane(self, lane);
+      }
+    }
+  }
+}
+
+static void
+launch_lane(CrystalModel *self,
+	    int lane)
+{
+  Point p;
+  crystal_drop_new_ion(&self->_walker, &p);
+  place_lane(self, lane, &p);
+  CRYSTAL_STAT(self->_batch.launch_steps[lane] = self->_steps);
+  CRYSTAL_STAT(self->_batch.escapes[lane] = 0);
+}
+
+/*
+ * Lanes carry linear indices into row-major baths while these and the
+ * squared kill radius fit in 32 bits; otherwise they are looked up per lane.
+ */
+static int
+linear_lanes(CrystalModel const *self)
+{
+  uint64_t const stride = Matrix_stride(self->_mat);
+  uint64_t const r_kill = self->_walker.r_kill;
+  MatrixLayout const layout = Matrix_layout(self->_mat);
+  return ((layout == MATRIX_LAYOUT_BYTES || layout == MATRIX_LAYOUT_BITS) &&
+	  stride * (stride + 1) <= INT32_MAX && r_kill * r_kill <= INT32_MAX);
+}
+
+static void
+place_lane(CrystalModel *self,
+	   int lane,
+	   Point const *p)
+{
+  self->_batch.x[lane] = p->x;
+  self->_batch.y[lane] = p->y;
+  self->_batch.idx[lane] = !linear_lanes(self) ? 0 :
+    (int32_t)(CrystalModel_x_bath_to_model_rep(self, p->x) +
+	      CrystalModel_y_bath_to_model_rep(self, p->y) * Matrix_stride(self->_mat));
+}
+
+/* Returns the sticky lanes as a bit mask, the escaped ones in *escaped. */
+static unsigned
+classify(CrystalModel const *self,
+	 unsigned *escaped)
+{
+  CrystalWalker const *w = &self->_walker;
+  unsigned sticky = 0;
+  Point p;
+
+  if (linear_lanes(self)) {
+    return classify_linear(self, escaped);
+  }
+  *escaped = 0;
+  for (int lane = 0; lane < BATCH_LANES; ++lane) {
+    p.x = self->_batch.x[lane];
+    p.y = self->_batch.y[lane];
+    if (crystal_outside_circle(w->r_kill, &p)) {
+      *escaped |= 1u << lane;
+    } else if (crystal_any_neighbours(self, &p)) {
+      sticky |= 1u << lane;
+    }
+  }
+  return sticky;
+}
+
+#ifdef __AVX2__
+
+static unsigned
+classify_linear(CrystalModel const *self,
+		unsigned *escaped)
+{
+  CrystalWalker const *w = &self->_walker;
+  __m256i const x = _mm256_loadu_si256((__m256i const *)self->_batch.x);
+  __m256i const y = _mm256_loadu_si256((__m256i const *)self->_batch.y);
+  __m256i const idx = _mm256_loadu_si256((__m256i const *)self->_batch.idx);
+  __m256i const r2 = _mm256_add_epi32(_mm256_mullo_epi32(x, x),
+				      _mm256_mullo_epi32(y, y));
+  __m256i const kill2 = _mm256_set1_epi32(w->r_kill * w->r_kill - 1);
+  __m256i n;
+
+  if (Matrix_has_halo(self->_mat)) {
+    /* One gather of the 32-bit halo word holding each lane's bit. */
+    int const *halo = (int const *)self->_mat->_halo;
+    n = _mm256_i32gather_epi32(halo, _mm256_srli_epi32(idx, 5), 4);
+    n = _mm256_srlv_epi32(n, _mm256_and_si256(idx, _mm256_set1_epi32(31)));
+    n = _mm256_and_si256(n, _mm256_set1_epi32(1));
+  } else {
+    /* Each gather reads four bytes; only the low one belongs to the cell. */
+    int const *base = (int const *)Matrix_at(self->_mat, 0, 0);
+    __m256i const one = _mm256_set1_epi32(1);
+    __m256i const row = _mm256_set1_epi32(Matrix_stride(self->_mat));
+    n = _mm256_i32gather_epi32(base, _mm256_add_epi32(idx, one), 1);
+    n = _mm256_or_si256(n, _mm256_i32gather_epi32(base, _mm256_sub_epi32(idx, one), 1));
+    n = _mm256_or_si256(n, _mm256_i32gather_epi32(base, _mm256_add_epi32(idx, row), 1));
+    n = _mm256_or_si256(n, _mm256_i32gather_epi32(base, _mm256_sub_epi32(idx, row), 1));
+    n = _mm256_and_si256(n, _mm256_set1_epi32(0xff));
+  }
+
+  *escaped = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(r2, kill2)));
+  return ~*escaped & ~_mm256_movemask_ps(_mm256_castsi256_ps(
+    _mm256_cmpeq_epi32(n, _mm256_setzero_si256()))) & ((1u << BATCH_LANES) - 1);
+}
+
+static void
+step_lanes(CrystalModel *self)
+{
+  CrystalWalker *w = &self->_walker;
+  int const size = Matrix_stride(self->_mat);
+  __m256i const dx_table = _mm256_setr_epi32(1, -1, 0, 0, 0, 0, 0, 0);
+  __m256i const dy_table = _mm256_setr_epi32(0, 0, 1, -1, 0, 0, 0, 0);
+  __m256i const di_table = _mm256_setr_epi32(1, -1, -size, size, 0, 0, 0, 0);
+  __m256i const shifts = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+  __m256i d, v;
+
+  if (w->n_dirs < BATCH_LANES) {
+    w->dirs = cs_rand(&w->rng);
+    w->n_dirs = 32;
+  }
+  d = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32((uint32_t)w->dirs), shifts),
+		       _mm256_set1_epi32(3));
+  w->dirs >>= 2*BATCH_LANES;
+  w->n_dirs -= BATCH_LANES;
+
+  v = _mm256_loadu_si256((__m256i const *)self->_batch.x);
+  _mm256_storeu_si256((__m256i *)self->_batch.x,
+		      _mm256_add_epi32(v, _mm256_permutevar8x32_epi32(dx_table, d)));
+  v = _mm256_loadu_si256((__m256i const *)self->_batch.y);
+  _mm256_storeu_si256((__m256i *)self->_batch.y,
+		      _mm256_add_epi32(v, _mm256_permutevar8x32_epi32(dy_table, d)));
+  v = _mm256_loadu_si256((__m256i const *)self->_batch.idx);
+  _mm256_storeu_si256((__m256i *)self->_batch.idx,
+		      _mm256_add_epi32(v, _mm256_permutevar8x32_epi32(di_table, d)));
+  self->_steps += BATCH_LANES;
+}
+
+#else /* __AVX2__ */
+
+static unsigned
+classify_linear(CrystalModel const *self,
+		unsigned *escaped)
+{
+  CrystalWalker const *w = &self->_walker;
+  int const size = Matrix_stride(self->_mat);
+  unsigned const kill2 = w->r_kill * w->r_kill;
+  unsigned sticky = 0;
+
+  *escaped = 0;
+  for (int lane = 0; lane < BATCH_LANES; ++lane) {
+    int const x = self->_batch.x[lane], y = self->_batch.y[lane];
+    int const i = self->_batch.idx[lane];
+    if ((unsigned)(x*x + y*y) >= kill2) {
+      *escaped |= 1u << lane;
+    } else if (Matrix_has_halo(self->_mat)) {
+      if ((self->_mat->_halo[i >> 6] >> (i & 63)) & 1) {
+	sticky |= 1u << lane;
+      }
+    } else {
+      matrix_t const *a = Matrix_at_const(self->_mat, 0, 0);
+      if (a[i+1] | a[i-1] | a[i+size] | a[i-size]) {
+	sticky |= 1u << lane;
+      }
+    }
+  }
+  return sticky;
+}
+
+static void
+step_lanes(CrystalModel *self)
+{
+  CrystalWalker *w = &self->_walker;
+  int const size = Matrix_stride(self->_mat);
+  int const dx[] = { 1, -1, 0, 0 };
+  int const dy[] = { 0, 0, 1, -1 };
+  int const di[] = { 1, -1, -size, size };
+  uint32_t bits;
+
+  if (w->n_dirs < BATCH_LANES) {
+    w->dirs = cs_rand(&w->rng);
+    w->n_dirs = 32;
+  }
+  bits = (uint32_t)w->dirs;
+  w->dirs >>= 2*BATCH_LANES;
+  w->n_dirs -= BATCH_LANES;
+
+  for (int lane = 0; lane < BATCH_LANES; ++lane, bits >>= 2) {
+    self->_batch.x[lane] += dx[bits & 3];
+    self->_batch.y[lane] += dy[bits & 3];
+    self->_batch.idx[lane] += di[bits & 3];
+  }
+  self->_steps += BATCH_LANES;
+}
+
+#endif /* __AVX2__ */
@@ -0,0 +1,277 @@
+#include "CrystalModelPrivate.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Checkpoint format, all integers in host byte order:
+ *
+ *   "CRYSTCK4"
+ *   header words (uint64_t), in the order of CrystalModel_save
+ *   bath: run lengths of the square [lo, hi]^2 of model cells around the
+ *         centre, row-major, alternating empty and occupied runs starting
+ *         with an empty one, each as a LEB128 varint
+ *   ion log, if enabled: x and y of every logged ion in sticking order,
+ *         zigzag encoded LEB128 varints
+ *   "CRYSTEND"
+ *
+ * The proximity map and halo plane are derived data and rebuilt on load.
+ */
+
+static char const head_magic[8] = { 'C', 'R', 'Y', 'S', 'T', 'C', 'K', '4' };
+static char const tail_magic[8] = { 'C', 'R', 'Y', 'S', 'T', 'E', 'N', 'D' };
+
+/* Number of header words, must match CrystalModel_save and _load. */
+#define HEADER_WORDS (17 + 4 + 3*BATCH_LANES + 3 + 5 + 1)
+
+static void
+bath_box(CrystalModel const *self,
+	 unsigned r_max,
+	 unsigned *lo,
+	 unsigned *hi);
+static void
+put_varint(FILE *out,
+	   uint64_t v);
+static int
+get_varint(FILE *in,
+	   uint64_t *v);
+static uint64_t
+zigzag(int v);
+static int
+unzigzag(uint64_t v);
+
+extern int
+CrystalModel_save(CrystalModel const *self,
+		  FILE *out)
+{
+  uint64_t h[HEADER_WORDS];
+  unsigned lo, hi, n = 0;
+  uint64_t run = 0;
+  int occupied = 0;
+  uint64_t const logged = self->_log.enabled ? CrystalModel_get_logged_ions(self) : 0;
+
+  if (self->_lattice != CRYSTAL_LATTICE_SQUARE || self->_rule != CRYSTAL_RULE_DLA) {
+    fprintf(stderr, "checkpoint: only square lattice models growing by DLA can be saved\n");
+    return -1;
+  }
+  bath_box(self, self->_r_max, &lo, &hi);
+  h[n++] = Matrix_size(self->_mat);
+  h[n++] = self->_r_start;
+  h[n++] = self->_r_escape;
+  h[n++] = self->_launch_mode;
+  h[n++] = self->_escape_mode;
+  h[n++] = self->_kernel;
+  h[n++] = self->_long_jumps;
+  h[n++] = self->_seed;
+  h[n++] = self->_ions;
+  h[n++] = self->_steps;
+  h[n++] = self->_retries;
+  h[n++] = self->_r_max;
+  h[n++] = (uint64_t)(int64_t)self->_p.x;
+  h[n++] = (uint64_t)(int64_t)self->_p.y;
+  h[n++] = lo;
+  h[n++] = hi;
+  h[n++] = self->_walker.n_dirs;
+  for (int k = 0; k < 4; ++k) {
+    h[n++] = self->_walker.rng.s[k];
+  }
+  for (int lane = 0; lane < BATCH_LANES; ++lane) {
+    h[n++] = (uint64_t)(int64_t)self->_batch.x[lane];
+    h[n++] = (uint64_t)(int64_t)self->_batch.y[lane];
+    h[n++] = (uint64_t)(int64_t)self->_batch.idx[lane];
+  }
+  h[n++] = self->_batch.live;
+  h[n++] = self->_walker.dirs;
+  h[n++] = self->_escapes;
+  /* A scalar walk interrupted by CrystalModel_run_budget. */
+  h[n++] = self->_walking;
+  h[n++] = (uint64_t)(int64_t)self->_walk_p.x;
+  h[n++] = (uint64_t)(int64_t)self->_walk_p.y;
+  h[n++] = self->_walker.steps;
+  h[n++] = self->_walker.escapes;
+  h[n++] = logged;
+
+  fwrite(head_magic, 1, sizeof(head_magic), out);
+  fwrite(h, sizeof(uint64_t), n, out);
+  for (unsigned j = lo; j <= hi; ++j) {
+    for (unsigned i = lo; i <= hi; ++i) {
+      if ((Matrix_get(self->_mat, i, j) != 0) != occupied) {
+	put_varint(out, run);
+	occupied = !occupied;
+	run = 0;
+      }
+      run++;
+    }
+  }
+  put_varint(out, run);
+  for (uint64_t i = 0; i < logged; ++i) {
+    Point const p = CrystalModel_get_logged_ion(self, i);
+    put_varint(out, zigzag(p.x));
+    put_varint(out, zigzag(p.y));
+  }
+  fwrite(tail_magic, 1, sizeof(tail_magic), out);
+  return ferror(out) ? -1 : 0;
+}
+
+extern int
+CrystalModel_load(CrystalModel *self,
+		  FILE *in)
+{
+  uint64_t h[HEADER_WORDS];
+  char magic[8];
+  unsigned n = 0, lo, hi;
+  uint64_t run, left, x, y;
+  int occupied = 0;
+  int const half = Matrix_size(self->_mat)/2;
+
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, head_magic, sizeof(magic)) != 0) {
+    fprintf(stderr, "checkpoint: not a checkpoint file\n");
+    return -1;
+  }
+  if (fread(h, sizeof(uint64_t), HEADER_WORDS, in) != HEADER_WORDS) {
+    fprintf(stderr, "checkpoint: truncated header\n");
+    return -1;
+  }
+  if (h[0] != Matrix_size(self->_mat) || h[1] != self->_r_start || h[2] != self->_r_escape) {
+    fprintf(stderr, "checkpoint: written for a bath of width %" PRIu64 " and radii %"
+	    PRIu64 "/%" PRIu64 ", not %u and %u/%u\n", h[0], h[1], h[2],
+	    Matrix_size(self->_mat), self->_r_start, self->_r_escape);
+    return -1;
+  }
+  n = 3;
+  /* Only square DLA is saved, the setters rebuild the neighbours and the kernel. */
+  if (self->_lattice != CRYSTAL_LATTICE_SQUARE) {
+    CrystalModel_set_lattice(self, CRYSTAL_LATTICE_SQUARE);
+  }
+  if (self->_rule != CRYSTAL_RULE_DLA) {
+    CrystalModel_set_rule(self, CRYSTAL_RULE_DLA, 1);
+  }
+  CrystalModel_set_launch_mode(self, (CrystalLaunchMode)h[n++]);
+  CrystalModel_set_escape_mode(self, (CrystalEscapeMode)h[n++]);
+  CrystalModel_set_kernel(self, (CrystalKernel)h[n++]);
+  CrystalModel_set_long_jumps(self, (int)h[n++]);
+  CrystalModel_reset(self);
+
+  /* The cells are stuck first, it updates the radii and derived planes. */
+  lo = (unsigned)h[14];
+  hi = (unsigned)h[15];
+  left = (uint64_t)(hi - lo + 1) * (hi - lo + 1);
+  for (uint64_t c = 0; left > 0; occupied = !occupied) {
+    if (get_varint(in, &run) || run > left) {
+      fprintf(stderr, "checkpoint: corrupt bath\n");
+      return -1;
+    }
+    left -= run;
+    for (; occupied && run > 0; --run, ++c) {
+      crystal_stick_ion(self,
+			(int)(lo + c % (hi - lo + 1)) - half,
+			half - (int)(lo + c / (hi - lo + 1)));
+    }
+    c += run;
+  }
+  /* The arrival order replaces the raster order the cells were logged in. */
+  if (h[HEADER_WORDS - 1] > 0) {
+    __atomic_store_n(&self->_log.count, 0, __ATOMIC_RELEASE);
+    self->_log.enabled = 1;
+  }
+  for (uint64_t i = 0; i < h[HEADER_WORDS - 1]; ++i) {
+    if (get_varint(in, &x) || get_varint(in, &y) ||
+	x >= 2*(uint64_t)half || y >= 2*(uint64_t)half ||
+	!CrystalModel_get_model_value(self, unzigzag(x), unzigzag(y))) {
+      fprintf(stderr, "checkpoint: corrupt ion log\n");
+      return -1;
+    }
+    crystal_log_ion(self, unzigzag(x), unzigzag(y));
+  }
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, tail_magic, sizeof(magic)) != 0) {
+    fprintf(stderr, "checkpoint: truncated bath\n");
+    return -1;
+  }
+
+  self->_seed = h[n++];
+  self->_ions = h[n++];
+  self->_steps = h[n++];
+  self->_retries = h[n++];
+  self->_r_max = (unsigned)h[n++];
+  self->_p.x = (int)(int64_t)h[n++];
+  self->_p.y = (int)(int64_t)h[n++];
+  n += 2;
+  self->_walker.n_dirs = (unsigned)h[n++];
+  for (int k = 0; k < 4; ++k) {
+    self->_walker.rng.s[k] = h[n++];
+  }
+  for (int lane = 0; lane < BATCH_LANES; ++lane) {
+    self->_batch.x[lane] = (int32_t)(int64_t)h[n++];
+    self->_batch.y[lane] = (int32_t)(int64_t)h[n++];
+    self->_batch.idx[lane] = (int32_t)(int64_t)h[n++];
+  }
+  self->_batch.live = (int)h[n++];
+  self->_walker.dirs = h[n++];
+  self->_escapes = h[n++];
+  self->_walking = (int)h[n++];
+  self->_walk_p.x = (int)(int64_t)h[n++];
+  self->_walk_p.y = (int)(int64_t)h[n++];
+  self->_walker.steps = h[n++];
+  self->_walker.escapes = h[n++];
+  /* The walk continues within the radii of the bath it started in. */
+  self->_walker.r_launch = self->_r_launch;
+  self->_walker.r_kill = self->_r_kill;
+  CRYSTAL_STAT(self->_walker.checks = 0);
+  CRYSTAL_STAT(self->_walker.seconds = 0);
+  return 0;
+}
+
+/* Square of model cells that holds every ion within r_max of the centre. */
+static void
+bath_box(CrystalModel const *self,
+	 unsigned r_max,
+	 unsigned *lo,
+	 unsigned *hi)
+{
+  unsigned const size = Matrix_size(self->_mat);
+  *lo = size/2 > r_max + 1 ? size/2 - r_max - 1 : 0;
+  *hi = size/2 + r_max + 1 < size ? size/2 + r_max + 1 : size - 1;
+}
+
+static void
+put_varint(FILE *out,
+	   uint64_t v)
+{
+  while (v >= 0x80) {
+    putc((int)(v & 0x7f) | 0x80, out);
+    v >>= 7;
+  }
+  putc((int)v, out);
+}
+
+static int
+get_varint(FILE *in,
+	   uint64_t *v)
+{
+  int c;
+  *v = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if ((c = getc(in)) == EOF) {
+      return -1;
+    }
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static uint64_t
+zigzag(int v)
+{
+  return v < 0 ? 2*(uint64_t)-(int64_t)v - 1 : 2*(uint64_t)v;
+}
+
+static int
+unzigzag(uint64_t v)
+{
+  return v & 1 ? -(int)(v >> 1) - 1 : (int)(v >> 1);
+}
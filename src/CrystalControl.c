@@ -8,17 +8,20 @@
 
 #include "root_directory.h" // This is a configuration file generated by CMake.
 
-#define DEFAULT_SPEED 10
+/* The simulation thread publishes its progress about once a frame. */
+#define FRAME_SECONDS (1.0 / 60)
 
 struct crystal_control_t
 {
-  unsigned _number;
+  unsigned _number;       /* ions per frame at most, 0 for no limit */
+  unsigned _threads;
   CrystalModel *_cm;
   CrystalView *_cv;
 
   GtkWidget *_main_app_window;
   
-  volatile int _sim_running;
+  int _cancel;            /* accessed atomically */
+  int _thread_started;
   pthread_t _thread;
 };
 
@@ -28,15 +31,6 @@ static void
 signal_stop_simulation(CrystalControl *self);
 static void *
 run_thread(void *arg);
-static gboolean
-run_some_steps(gpointer data);
-
-static double
-get_time() {
-  struct timespec t;
-  clock_gettime(CLOCK_REALTIME, &t);
-  return t.tv_sec + t.tv_nsec/1e9;
-}
 
 CrystalControl *
 CrystalControl_create(CrystalModel *cm,
@@ -46,10 +40,16 @@ CrystalControl_create(CrystalModel *cm,
   self->_cm = cm;
   self->_cv = cv;
 
-  self->_number = DEFAULT_SPEED;
   return self;
 }
 
+void
+CrystalControl_set_threads(CrystalControl *self,
+			   unsigned threads)
+{
+  self->_threads = threads;
+}
+
 void
 CrystalControl_destroy(CrystalControl *self)
 {
@@ -88,7 +88,7 @@ CrystalControl_request_new_modifier(CrystalControl *self)
   
   gtk_entry_set_input_purpose(GTK_ENTRY(new_mod_tf), GTK_INPUT_PURPOSE_DIGITS);
   gtk_box_pack_start(GTK_BOX(dialog_content),
-		     gtk_label_new("Enter a new speed:"),
+		     gtk_label_new("Enter the most ions per frame:"),
 		     FALSE, FALSE, 0);
   gtk_box_pack_start(GTK_BOX(dialog_content),
 		     new_mod_tf,
@@ -124,37 +124,43 @@ CrystalControl_request_new_modifier(CrystalControl *self)
 static void
 signal_stop_simulation(CrystalControl *self)
 {
-  if (self->_sim_running) {
-    self->_sim_running = 0;
+  /* Also interrupts a walk in progress, it continues on the next start. */
+  __atomic_store_n(&self->_cancel, 1, __ATOMIC_RELEASE);
+  if (self->_thread_started) {
+    pthread_join(self->_thread, NULL);
+    self->_thread_started = 0;
   }
-  pthread_join(self->_thread, NULL);
 }
 
+/*
+ * Grows the crystal in frame long slices and publishes the statistics
+ * after each one; the view picks the new ions up from the ion log on its
+ * own frame clock.
+ */
 static void *
 run_thread(void *arg)
 {
-  double t0, t1;
+  double start, t0, t1;
   CrystalControl *self = (CrystalControl *)arg;
-
-  t0 = get_time();
-  while (self->_sim_running) {
-    if (!CrystalModel_run_some_steps(self->_cm, self->_number)) {
-      self->_sim_running = 0;
+  CrystalBudget budget = { 0, 0, FRAME_SECONDS, &self->_cancel };
+  int more = 1;
+
+  start = crystal_time();
+  while (more && !__atomic_load_n(&self->_cancel, __ATOMIC_ACQUIRE)) {
+    budget.max_ions = self->_number;
+    t0 = crystal_time();
+    more = CrystalModel_run_budget(self->_cm, &budget, self->_threads, NULL);
+    CrystalView_publish_stats(self->_cv);
+    t1 = crystal_time();
+    if (self->_number && t1 - t0 < FRAME_SECONDS) {
+      struct timespec const pause = { 0, (long)((FRAME_SECONDS - (t1 - t0)) * 1e9) };
+      nanosleep(&pause, NULL);
     }
-    g_timeout_add(0, run_some_steps, self);
   }
-  t1 = get_time();
-  printf("C Simulation took %.3f s\n", t1-t0);
+  printf("C Simulation took %.3f s\n", crystal_time() - start);
   return NULL;
 }
 
-static gboolean
-run_some_steps(gpointer data)
-{
-  CrystalView_repaint(((CrystalControl *)data)->_cv);
-  return FALSE; // run once
-}
-
 static gboolean
 change_speed_event_cb(GtkWidget *widget,
 		      gpointer data)
@@ -192,14 +198,14 @@ start_event_cb(GtkWidget *widget,
   signal_stop_simulation(self);
   
   CrystalModel_reset(self->_cm);
+  CrystalView_publish_stats(self->_cv);
+  /* Lets the view see the reset before the new crystal outgrows the old. */
   CrystalView_repaint(self->_cv);
   
-  if (!self->_sim_running) {
-    //CrystalModel_srand(self->_cm, time(NULL));
-    CrystalModel_srand(self->_cm, 0);
-    self->_sim_running = 1;
-    pthread_create(&self->_thread, NULL, run_thread, self);
-  }
+  //CrystalModel_srand(self->_cm, time(NULL));
+  CrystalModel_srand(self->_cm, 0);
+  self->_cancel = 0;
+  self->_thread_started = pthread_create(&self->_thread, NULL, run_thread, self) == 0;
   return TRUE;
 }
 
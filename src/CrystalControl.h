@@ -13,6 +13,9 @@ CrystalControl_create(CrystalModel *cm,
 extern void
 CrystalControl_destroy(CrystalControl *self);
 extern void
+CrystalControl_set_threads(CrystalControl *self,
+			   unsigned threads);
+extern void
 CrystalControl_init_ui(CrystalControl *self,
 		       GtkBuilder *builder);
 
@@ -0,0 +1,58 @@
+#include "CrystalModelPrivate.h"
+
+#include <stdlib.h>
+
+/*
+ * Eden growth. The perimeter holds every empty site next to the cluster
+ * once, by the neighbours of the lattice geometry, marked in _sites so it
+ * is not added twice; each ion fills a uniformly chosen perimeter site,
+ * which is swapped out of the list, and adds the empty neighbours of
+ * that site. No walker moves, so there are no steps to count and no
+ * limit to check.
+ */
+
+#define MIN_PERIMETER 1024
+
+extern int
+crystal_eden_crystallize_one_ion(CrystalModel *self)
+{
+  CrystalWalker *w = &self->_walker;
+  uint64_t i;
+  Point p;
+  CRYSTAL_STAT(double const t0 = crystal_time());
+
+  crystal_begin_ion(self, w, self->_ions);
+  i = (uint64_t)(cs_drand(&w->rng) * self->_eden.n);
+  p = self->_eden.sites[i];
+  self->_eden.sites[i] = self->_eden.sites[--self->_eden.n];
+  self->_p = p;
+  crystal_stick_ion(self, p.x, p.y);
+  CRYSTAL_STAT(crystal_stats_record(&self->_stats, 0, 0, 0, &p, crystal_time() - t0));
+  return (unsigned)crystal_site_radius(self->_lattice, &self->_p) < self->_r_start;
+}
+
+extern void
+crystal_eden_add_perimeter(CrystalModel *self,
+			   int x,
+			   int y)
+{
+  Point const *dp = self->_nb.dp[y & 1];
+
+  for (unsigned k = 0; k < self->_nb.n; ++k) {
+    int const qx = x + dp[k].x, qy = y + dp[k].y;
+    unsigned const i = CrystalModel_x_bath_to_model_rep(self, qx);
+    unsigned const j = CrystalModel_y_bath_to_model_rep(self, qy);
+    if (Matrix_get(self->_mat, i, j) || Matrix_get(self->_sites, i, j)) {
+      continue;
+    }
+    Matrix_set(self->_sites, i, j, 1);
+    if (self->_eden.n == self->_eden.capacity) {
+      self->_eden.capacity = self->_eden.n ? 2 * self->_eden.n : MIN_PERIMETER;
+      self->_eden.sites = (Point *)realloc(self->_eden.sites,
+					   self->_eden.capacity * sizeof(Point));
+    }
+    self->_eden.sites[self->_eden.n].x = qx;
+    self->_eden.sites[self->_eden.n].y = qy;
+    self->_eden.n++;
+  }
+}
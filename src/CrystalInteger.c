@@ -0,0 +1,187 @@
+#include "CrystalModelPrivate.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+/*
+ * Integer kernel: the walk of the scalar DLA kernel on the square
+ * lattice, in the same order and on the same random draws, so it grows
+ * the same crystal. Walkers carry the linear index of their cell next to
+ * their position, so a neighbour test is a bit of the halo plane or four
+ * bytes of the bath, and the kill circle is a comparison of squared
+ * radii. Relaunches look their site up in a table of the launch circle
+ * by the leading bits of the draw. An entry is only filled once both
+ * ends of its interval of draws give the same site, and the sites move
+ * monotonically within an interval, so it holds the site of every draw
+ * in between; entries whose interval crosses a change of site compute
+ * it as crystal_drop_new_ion does.
+ */
+
+/* The table has at least 2^LAUNCH_SHIFT entries per unit of radius. */
+#define LAUNCH_SHIFT 5
+#define LAUNCH_MIN_BITS 8
+#define LAUNCH_MAX_BITS 18
+#define LAUNCH_UNKNOWN INT_MIN
+#define LAUNCH_SPLIT INT_MAX
+
+static void
+prepare_launch(CrystalModel *self,
+	       unsigned r);
+static void
+fill_launch(CrystalModel *self,
+	    Point *site);
+
+static inline __attribute__((always_inline)) void
+launch(CrystalModel *self,
+       CrystalWalker *w,
+       Point *p)
+{
+  uint64_t const u = cs_rand(&w->rng) >> 11;
+  Point *site;
+
+  if (w->r_launch != self->_launch.r) {
+    prepare_launch(self, w->r_launch);
+  }
+  site = &self->_launch.sites[u >> (53 - self->_launch.bits)];
+  if (site->x == LAUNCH_UNKNOWN) {
+    fill_launch(self, site);
+  }
+  if (site->x == LAUNCH_SPLIT) {
+    crystal_launch_point(w->r_launch, u, p);
+  } else {
+    *p = *site;
+  }
+}
+
+static inline size_t
+bath_index(CrystalModel const *self,
+	   Point const *p)
+{
+  return (CrystalModel_x_bath_to_model_rep(self, p->x) +
+	  (size_t)CrystalModel_y_bath_to_model_rep(self, p->y) * Matrix_stride(self->_mat));
+}
+
+/* Walks the current ion, on a bath with a halo plane or of bytes. */
+static inline __attribute__((always_inline)) int
+crystallize_walk(CrystalModel *self,
+		 int const halo)
+{
+  CrystalWalker *w = &self->_walker;
+  ptrdiff_t const stride = Matrix_stride(self->_mat);
+  ptrdiff_t const di[] = { 1, -1, -stride, stride };
+  uint64_t const *bits = self->_mat->_halo;
+  matrix_t const *cells = halo ? NULL : Matrix_at_const(self->_mat, 0, 0);
+  uint64_t kill2, check;
+  size_t i;
+  Point p;
+  CRYSTAL_STAT(double const t0 = crystal_time());
+
+  if (self->_walking) {
+    p = self->_walk_p;
+    self->_walking = 0;
+  } else {
+    crystal_begin_ion(self, w, self->_ions);
+    launch(self, w, &p);
+  }
+  i = bath_index(self, &p);
+  kill2 = (uint64_t)w->r_kill * w->r_kill;
+  check = self->_limit ? w->steps + CRYSTAL_CHECK_STEPS : UINT64_MAX;
+  for (;;) {
+    unsigned d;
+    CRYSTAL_STAT(w->checks++);
+    if (halo ? (bits[i >> 6] >> (i & 63)) & 1 :
+	(cells[i + 1] | cells[i - 1] | cells[i + stride] | cells[i - stride])) {
+      break;
+    }
+    if ((uint64_t)((int64_t)p.x*p.x + (int64_t)p.y*p.y) >= kill2) {
+      if (self->_escape_mode == CRYSTAL_ESCAPE_RETURN) {
+	crystal_escape(self, w, &p);
+      } else {
+	launch(self, w, &p);
+      }
+      i = bath_index(self, &p);
+      w->escapes++;
+    }
+    if (w->n_dirs == 0) {
+      w->dirs = cs_rand(&w->rng);
+      w->n_dirs = 32;
+    }
+    d = w->dirs & 3;
+    w->dirs >>= 2;
+    w->n_dirs--;
+    w->steps++;
+    p.x += crystal_dp[d].x;
+    p.y += crystal_dp[d].y;
+    i += di[d];
+    if (w->steps >= check) {
+      if (crystal_limit_reached(self, self->_steps + w->steps)) {
+	CRYSTAL_STAT(w->seconds += crystal_time() - t0);
+	self->_walk_p = p;
+	self->_walking = 1;
+	return 1;
+      }
+      check += CRYSTAL_CHECK_STEPS;
+    }
+  }
+  self->_steps += w->steps;
+  self->_escapes += w->escapes;
+  self->_p = p;
+  crystal_stick_ion(self, p.x, p.y);
+  CRYSTAL_STAT(crystal_stats_record(&self->_stats, w->steps, w->escapes, w->checks, &p,
+				    w->seconds + crystal_time() - t0));
+  return !crystal_outside_circle(self->_r_start, &self->_p);
+}
+
+extern int
+crystal_integer_crystallize_one_ion(CrystalModel *self)
+{
+  if (Matrix_has_halo(self->_mat)) {
+    return crystallize_walk(self, 1);
+  }
+  return crystallize_walk(self, 0);
+}
+
+/* Empties the table for radius `r`, growing it with the radius. */
+static void
+prepare_launch(CrystalModel *self,
+	       unsigned r)
+{
+  unsigned bits = LAUNCH_MIN_BITS;
+  size_t n;
+
+  while (bits < LAUNCH_MAX_BITS && (size_t)1 << bits < (size_t)r << LAUNCH_SHIFT) {
+    bits++;
+  }
+  n = (size_t)1 << bits;
+  if (bits != self->_launch.bits || !self->_launch.sites) {
+    free(self->_launch.sites);
+    self->_launch.sites = (Point *)malloc(n * sizeof(Point));
+    self->_launch.bits = bits;
+  }
+  for (size_t k = 0; k < n; ++k) {
+    self->_launch.sites[k].x = LAUNCH_UNKNOWN;
+  }
+  self->_launch.r = r;
+}
+
+/*
+ * Entries never straddle a quarter of the circle, where the coordinates
+ * turn, so the sites of the first and last draw of an interval bound
+ * those of the draws in between.
+ */
+static void
+fill_launch(CrystalModel *self,
+	    Point *site)
+{
+  unsigned const shift = 53 - self->_launch.bits;
+  uint64_t const first = (uint64_t)(site - self->_launch.sites) << shift;
+  Point a, b;
+
+  crystal_launch_point(self->_launch.r, first, &a);
+  crystal_launch_point(self->_launch.r, first + ((UINT64_C(1) << shift) - 1), &b);
+  if (a.x == b.x && a.y == b.y) {
+    *site = a;
+  } else {
+    site->x = LAUNCH_SPLIT;
+  }
+}
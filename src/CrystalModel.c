@@ -1,39 +1,111 @@
 #include "CrystalModel.h"
 
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <math.h>
 
+#include "CrystalModelPrivate.h"
 #include "Matrix.h"
 #include "Point.h"
 #include "random.h"
 
-struct crystal_model_t
-{
-  Matrix *_mat;
-  Point _p;
-  unsigned _r_start;
-  unsigned _r_escape;
-  char *_s;
-};
+/* Walkers only jump when the jump radius is at least this large. */
+#define MIN_JUMP 2
+/* Distance between the crystal and the adaptive launch circle. */
+#define LAUNCH_MARGIN 5
+/* Ratio between the adaptive kill and launch radii. */
+#define KILL_FACTOR 2
+/* Seed used until CrystalModel_srand is called. */
+#define DEFAULT_SEED 1
+/* The fractal dimension is fitted from this radius to half the crystal
+   radius, FIT_STEPS radii per octave. */
+#define FIT_R_MIN 4
+#define FIT_STEPS 4
 
+static void
+return_to_launch_circle(CrystalModel const *self,
+			CrystalWalker *w,
+			double *x,
+			double *y);
 static int
-outside_circle(unsigned rEscape,
-	       Point const *p);
-static int
-any_neighbours(CrystalModel const * self,
-	       Point const * p);
+jump_once(CrystalModel const *self,
+	  CrystalWalker *w,
+	  Point *p);
+static void
+update_proximity(CrystalModel *self,
+		 int x,
+		 int y);
+static void
+rebuild_proximity(CrystalModel *self);
 static void
-drop_new_ion(unsigned r_start,
-	     Point *p);
+create_proximity(CrystalModel *self);
 static void
-step_once(Point *p);
-static matrix_t *
-bath_at(CrystalModel const *self,
-	int x,
-	int y);
+update_radii(CrystalModel *self);
+static void
+clear_cluster(CrystalModel *self);
+static uint64_t
+walked_steps(CrystalModel const *self);
+static matrix_t
+bath_at_prox(CrystalModel const *self,
+	     int x,
+	     int y);
+static void
+launch_ballistic(CrystalWalker *w,
+		 Point *p,
+		 CrystalLattice lattice);
+static void
+select_kernel(CrystalModel *self);
+static void
+build_neighbours(CrystalModel *self);
 
-static Point const dp[] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+/*
+ * The step along the line of a ballistic walker: of the two moves towards
+ * its direction, the one that stays closer to the line.
+ */
+static inline void
+step_ballistic(CrystalWalker *w,
+	       Point *p)
+{
+  int const sx = w->ux >= 0 ? 1 : -1, sy = w->uy >= 0 ? 1 : -1;
+  double const ex = fabs((p->x + sx - w->ox) * w->uy - (p->y - w->oy) * w->ux);
+  double const ey = fabs((p->x - w->ox) * w->uy - (p->y + sy - w->oy) * w->ux);
+
+  if (ex <= ey) {
+    p->x += sx;
+  } else {
+    p->y += sy;
+  }
+  w->steps++;
+}
+
+/* Of the neighbours towards its direction, the one closest to the line. */
+static inline void
+step_ballistic_hex(CrystalModel const *self,
+		   CrystalWalker *w,
+		   Point *p)
+{
+  Point const *dp = self->_nb.dp[p->y & 1];
+  Point next = *p;
+  double px, py, qx, qy, best = INFINITY;
+
+  crystal_site_position(CRYSTAL_LATTICE_HEX, p->x, p->y, &px, &py);
+  for (unsigned k = 0; k < 6; ++k) {
+    double e;
+    crystal_site_position(CRYSTAL_LATTICE_HEX, p->x + dp[k].x, p->y + dp[k].y, &qx, &qy);
+    if ((qx - px) * w->ux + (qy - py) * w->uy <= 0) {
+      continue;
+    }
+    e = fabs((qx - w->ox) * w->uy - (qy - w->oy) * w->ux);
+    if (e < best) {
+      best = e;
+      next.x = p->x + dp[k].x;
+      next.y = p->y + dp[k].y;
+    }
+  }
+  *p = next;
+  w->steps++;
+}
 
 extern CrystalModel *
 CrystalModel_create(Matrix *mat,
@@ -45,8 +117,27 @@ CrystalModel_create(Matrix *mat,
   self->_r_start = r_start;
   self->_r_escape = r_escape;
   self->_mat = mat;
-  self->_s = (char *) calloc((Matrix_size(mat)+2)*(Matrix_size(mat)+2) + 1, sizeof(char));
+  self->_launch_mode = CRYSTAL_LAUNCH_FIXED;
+  self->_escape_mode = CRYSTAL_ESCAPE_RELAUNCH;
+  self->_kernel = CRYSTAL_KERNEL_SCALAR;
+  self->_lattice = CRYSTAL_LATTICE_SQUARE;
+  self->_rule = CRYSTAL_RULE_DLA;
+  self->_stick_p = 1;
+  self->_hits = 1;
+  build_neighbours(self);
+  select_kernel(self);
 
+  for (int dy = -DIST_CAP; dy <= DIST_CAP; ++dy) {
+    for (int dx = -DIST_CAP; dx <= DIST_CAP; ++dx) {
+      unsigned d = (unsigned)sqrt(dx*dx + dy*dy);
+      self->_prox_stencil[dy+DIST_CAP][dx+DIST_CAP] = d < DIST_CAP ? DIST_CAP - d : 0;
+    }
+  }
+  for (int i = 0; i < RETURN_TABLE_SIZE; ++i) {
+    self->_cauchy[i] = tan(M_PI * ((i + 0.5) / RETURN_TABLE_SIZE - 0.5));
+  }
+
+  CrystalModel_srand(self, DEFAULT_SEED);
   CrystalModel_reset(self);
   return self;
 }
@@ -57,20 +148,337 @@ CrystalModel_destroy(CrystalModel *self)
   if (!self) { return; }
 
   free(self->_s); self->_s = NULL;
+  free(self->_cluster.mass); self->_cluster.mass = NULL;
+  for (int k = 0; k < ION_LOG_CHUNKS; ++k) {
+    free(self->_log.chunks[k]);
+  }
+  Matrix_destroy(self->_prox); self->_prox = NULL;
+  Matrix_destroy(self->_sites); self->_sites = NULL;
+  free(self->_eden.sites); self->_eden.sites = NULL;
+  free(self->_launch.sites); self->_launch.sites = NULL;
+  crystal_off_free(self);
   free(self);
 }
 
-extern int
-CrystalModel_crystallize_one_ion(CrystalModel *self) {
+extern void
+CrystalModel_set_radii(CrystalModel *self,
+		       unsigned r_start,
+		       unsigned r_escape)
+{
+  self->_r_start = r_start;
+  self->_r_escape = r_escape;
+  /* The picture and the mass-radius counts are as large as the escape circle. */
+  free(self->_s); self->_s = NULL;
+  free(self->_cluster.mass); self->_cluster.mass = NULL;
+  CrystalModel_reset(self);
+}
+
+/*
+ * The parts of the kernels that depend on the lattice, always called
+ * with a constant one. CRYSTAL_LATTICE_SQUARE keeps the helpers shared
+ * with the batched and parallel kernels.
+ */
+static inline __attribute__((always_inline)) int
+outside(unsigned r,
+	Point const *p,
+	CrystalLattice const lattice)
+{
+  if (lattice == CRYSTAL_LATTICE_HEX) {
+    return (unsigned)crystal_site_radius(lattice, p) >= r;
+  }
+  return crystal_outside_circle(r, p);
+}
+
+static inline __attribute__((always_inline)) int
+sticks(CrystalModel const *self,
+       CrystalWalker *w,
+       Point const *p,
+       CrystalLattice const lattice)
+{
+  unsigned const n = lattice == CRYSTAL_LATTICE_HEX ? 6 : 8;
+  int const odd = lattice == CRYSTAL_LATTICE_HEX ? p->y & 1 : 0;
+  unsigned x, y;
+
+  if (lattice == CRYSTAL_LATTICE_SQUARE) {
+    return crystal_walker_sticks(self, w, p);
+  }
+  CRYSTAL_STAT(w->checks++);
+  x = CrystalModel_x_bath_to_model_rep(self, p->x);
+  y = CrystalModel_y_bath_to_model_rep(self, p->y);
+  if (Matrix_has_halo(self->_mat)) {
+    return Matrix_get_halo(self->_mat, x, y);
+  }
+  if (Matrix_layout(self->_mat) == MATRIX_LAYOUT_BYTES) {
+    matrix_t const *c = Matrix_at_const(self->_mat, x, y);
+    for (unsigned k = 0; k < n; ++k) {
+      if (c[self->_nb.di[odd][k]]) {
+	return 1;
+      }
+    }
+    return 0;
+  }
+  for (unsigned k = 0; k < n; ++k) {
+    if (Matrix_get(self->_mat, x + self->_nb.dp[odd][k].x, y - self->_nb.dp[odd][k].y)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Square walkers draw 2 bits a step, the others 3, HEX drawing again past 5. */
+static inline __attribute__((always_inline)) void
+step_site(CrystalModel const *self,
+	  CrystalWalker *w,
+	  Point *p,
+	  CrystalLattice const lattice)
+{
+  Point const *d;
+  unsigned k;
+
+  if (lattice == CRYSTAL_LATTICE_SQUARE) {
+    crystal_step_once(w, p);
+    return;
+  }
+  do {
+    if (w->n_dirs == 0) {
+      w->dirs = cs_rand(&w->rng);
+      w->n_dirs = 21;
+    }
+    k = w->dirs & 7;
+    w->dirs >>= 3;
+    w->n_dirs--;
+  } while (lattice == CRYSTAL_LATTICE_HEX && k >= 6);
+  d = &self->_nb.dp[p->y & 1][k];
+  w->steps++;
+  p->x += d->x;
+  p->y += d->y;
+}
+
+static inline __attribute__((always_inline)) void
+launch_site(CrystalWalker *w,
+	    Point *p,
+	    CrystalLattice const lattice)
+{
+  double alpha;
+
+  if (lattice != CRYSTAL_LATTICE_HEX) {
+    crystal_drop_new_ion(w, p);
+    return;
+  }
+  alpha = 2 * M_PI * cs_drand(&w->rng);
+  *p = crystal_site_at(lattice, w->r_launch * cos(alpha), w->r_launch * sin(alpha));
+}
+
+static inline __attribute__((always_inline)) void
+escape_site(CrystalModel const *self,
+	    CrystalWalker *w,
+	    Point *p,
+	    CrystalLattice const lattice)
+{
+  double x, y;
+
+  if (lattice != CRYSTAL_LATTICE_HEX) {
+    crystal_escape(self, w, p);
+  } else if (self->_escape_mode == CRYSTAL_ESCAPE_RETURN) {
+    crystal_site_position(lattice, p->x, p->y, &x, &y);
+    return_to_launch_circle(self, w, &x, &y);
+    *p = crystal_site_at(lattice, x, y);
+  } else {
+    launch_site(w, p, lattice);
+  }
+}
+
+/* How a walker at a site next to the crystal ends under a rule. */
+enum { WALK_ON, WALK_STUCK, WALK_ABSORBED };
+
+/*
+ * Whether the walker next to the crystal at `p` sticks, is absorbed or
+ * walks on. Only called by the kernels, with a constant rule.
+ */
+static inline __attribute__((always_inline)) int
+contact(CrystalModel *self,
+	CrystalWalker *w,
+	Point const *p,
+	CrystalRule const rule)
+{
+  unsigned x, y, hits;
+
+  switch (rule) {
+  case CRYSTAL_RULE_STICKY:
+    return cs_drand(&w->rng) < self->_stick_p ? WALK_STUCK : WALK_ON;
+  case CRYSTAL_RULE_NOISE:
+    x = CrystalModel_x_bath_to_model_rep(self, p->x);
+    y = CrystalModel_y_bath_to_model_rep(self, p->y);
+    hits = Matrix_get(self->_sites, x, y) + 1;
+    if (hits >= self->_hits) {
+      return WALK_STUCK;
+    }
+    Matrix_set(self->_sites, x, y, hits);
+    return WALK_ABSORBED;
+  default:
+    return WALK_STUCK;
+  }
+}
+
+/* One step of a walker under `rule`, as for contact. */
+static inline __attribute__((always_inline)) void
+step_walker(CrystalModel const *self,
+	    CrystalWalker *w,
+	    Point *p,
+	    CrystalRule const rule,
+	    CrystalLattice const lattice)
+{
+  Point const from = *p;
+
+  if (rule == CRYSTAL_RULE_BALLISTIC) {
+    if (lattice == CRYSTAL_LATTICE_HEX) {
+      step_ballistic_hex(self, w, p);
+    } else {
+      step_ballistic(w, p);
+    }
+    return;
+  }
+  step_site(self, w, p, lattice);
+  /* Walkers that did not stick next to the crystal may not step into it. */
+  if (rule == CRYSTAL_RULE_STICKY && CrystalModel_get_model_value(self, p->x, p->y)) {
+    *p = from;
+  }
+}
+
+/*
+ * Walks the current ion under `rule` on `lattice` until it sticks.
+ * Within CrystalModel_run_budget the walk may stop at a limit instead;
+ * the walker then waits at _walk_p and the next call continues the same
+ * walk. Every use passes constant arguments, so each instantiation below
+ * is a kernel of its own without the branches of the other rules and
+ * lattices. Long jumps are only instantiated on CRYSTAL_LATTICE_SQUARE.
+ */
+static inline __attribute__((always_inline)) int
+crystallize_walk(CrystalModel *self,
+		 CrystalRule const rule,
+		 int const jumps,
+		 CrystalLattice const lattice)
+{
   Point p = { 0, 0 };
-  for (drop_new_ion(self->_r_start, &p); !any_neighbours(self, &p); step_once(&p)) {
-    if (outside_circle(self->_r_escape, &p)) {
-      drop_new_ion(self->_r_start, &p);
+  CrystalWalker *w = &self->_walker;
+  uint64_t check;
+  int end = WALK_ON;
+  CRYSTAL_STAT(double const t0 = crystal_time());
+
+  if (self->_walking) {
+    p = self->_walk_p;
+    self->_walking = 0;
+  } else {
+    crystal_begin_ion(self, w, self->_ions);
+    if (rule == CRYSTAL_RULE_BALLISTIC) {
+      launch_ballistic(w, &p, lattice);
+    } else {
+      launch_site(w, &p, lattice);
+    }
+  }
+  check = self->_limit ? w->steps + CRYSTAL_CHECK_STEPS : UINT64_MAX;
+  if (jumps) {
+    for (;;) {
+      if (w->steps >= check) {
+	if (crystal_limit_reached(self, self->_steps + w->steps)) {
+	  CRYSTAL_STAT(w->seconds += crystal_time() - t0);
+	  self->_walk_p = p;
+	  self->_walking = 1;
+	  return 1;
+	}
+	check += CRYSTAL_CHECK_STEPS;
+      }
+      if (crystal_outside_circle(w->r_kill, &p)) {
+	crystal_escape(self, w, &p);
+	w->escapes++;
+      } else if (crystal_walker_sticks(self, w, &p) &&
+		 (end = contact(self, w, &p, rule)) != WALK_ON) {
+	break;
+      } else if (jump_once(self, w, &p)) {
+	w->steps++;
+      } else {
+	step_walker(self, w, &p, rule, lattice);
+      }
+    }
+  } else {
+    while (!(sticks(self, w, &p, lattice) &&
+	     (end = contact(self, w, &p, rule)) != WALK_ON)) {
+      if (outside(w->r_kill, &p, lattice)) {
+	if (rule == CRYSTAL_RULE_BALLISTIC) {
+	  launch_ballistic(w, &p, lattice);
+	} else {
+	  escape_site(self, w, &p, lattice);
+	}
+	w->escapes++;
+      }
+      step_walker(self, w, &p, rule, lattice);
+      if (w->steps >= check) {
+	if (crystal_limit_reached(self, self->_steps + w->steps)) {
+	  CRYSTAL_STAT(w->seconds += crystal_time() - t0);
+	  self->_walk_p = p;
+	  self->_walking = 1;
+	  return 1;
+	}
+	check += CRYSTAL_CHECK_STEPS;
+      }
     }
   }
+  self->_steps += w->steps;
+  self->_escapes += w->escapes;
+  if (end == WALK_ABSORBED) {
+    self->_ions++;
+    return 1;
+  }
   self->_p = p;
-  *bath_at(self, p.x, p.y) = 1;
-  return !outside_circle(self->_r_start, &self->_p);
+  crystal_stick_ion(self, p.x, p.y);
+  CRYSTAL_STAT(crystal_stats_record(&self->_stats, w->steps, w->escapes, w->checks, &p,
+				    w->seconds + crystal_time() - t0));
+  return !outside(self->_r_start, &self->_p, lattice);
+}
+
+#define WALK_KERNEL(name, rule, jumps, lattice)			\
+  static int							\
+  name(CrystalModel *self)					\
+  {								\
+    return crystallize_walk(self, rule, jumps, lattice);	\
+  }
+
+WALK_KERNEL(walk_dla, CRYSTAL_RULE_DLA, 0, CRYSTAL_LATTICE_SQUARE)
+WALK_KERNEL(walk_dla_jumps, CRYSTAL_RULE_DLA, 1, CRYSTAL_LATTICE_SQUARE)
+WALK_KERNEL(walk_dla_square8, CRYSTAL_RULE_DLA, 0, CRYSTAL_LATTICE_SQUARE8)
+WALK_KERNEL(walk_dla_hex, CRYSTAL_RULE_DLA, 0, CRYSTAL_LATTICE_HEX)
+WALK_KERNEL(walk_sticky, CRYSTAL_RULE_STICKY, 0, CRYSTAL_LATTICE_SQUARE)
+WALK_KERNEL(walk_sticky_jumps, CRYSTAL_RULE_STICKY, 1, CRYSTAL_LATTICE_SQUARE)
+WALK_KERNEL(walk_sticky_square8, CRYSTAL_RULE_STICKY, 0, CRYSTAL_LATTICE_SQUARE8)
+WALK_KERNEL(walk_sticky_hex, CRYSTAL_RULE_STICKY, 0, CRYSTAL_LATTICE_HEX)
+WALK_KERNEL(walk_noise, CRYSTAL_RULE_NOISE, 0, CRYSTAL_LATTICE_SQUARE)
+WALK_KERNEL(walk_noise_jumps, CRYSTAL_RULE_NOISE, 1, CRYSTAL_LATTICE_SQUARE)
+WALK_KERNEL(walk_noise_square8, CRYSTAL_RULE_NOISE, 0, CRYSTAL_LATTICE_SQUARE8)
+WALK_KERNEL(walk_noise_hex, CRYSTAL_RULE_NOISE, 0, CRYSTAL_LATTICE_HEX)
+WALK_KERNEL(walk_ballistic, CRYSTAL_RULE_BALLISTIC, 0, CRYSTAL_LATTICE_SQUARE)
+WALK_KERNEL(walk_ballistic_square8, CRYSTAL_RULE_BALLISTIC, 0, CRYSTAL_LATTICE_SQUARE8)
+WALK_KERNEL(walk_ballistic_hex, CRYSTAL_RULE_BALLISTIC, 0, CRYSTAL_LATTICE_HEX)
+
+/*
+ * Walking kernels by rule, and by lattice: square, square with long
+ * jumps, square with diagonals and hexagonal.
+ */
+static int (*const walk_kernels[][4])(CrystalModel *self) = {
+  [CRYSTAL_RULE_DLA] = { walk_dla, walk_dla_jumps, walk_dla_square8, walk_dla_hex },
+  [CRYSTAL_RULE_STICKY] = { walk_sticky, walk_sticky_jumps, walk_sticky_square8, walk_sticky_hex },
+  [CRYSTAL_RULE_NOISE] = { walk_noise, walk_noise_jumps, walk_noise_square8, walk_noise_hex },
+  [CRYSTAL_RULE_BALLISTIC] = { walk_ballistic, walk_ballistic, walk_ballistic_square8,
+			       walk_ballistic_hex },
+};
+
+extern int
+CrystalModel_crystallize_one_ion(CrystalModel *self)
+{
+  /* A loaded checkpoint may hold a crystal that has already finished. */
+  if (crystal_finished(self)) {
+    return 0;
+  }
+  return self->_crystallize(self);
 }
 
 extern int
@@ -78,14 +486,63 @@ CrystalModel_get_model_value(CrystalModel const *self,
 			     int x,
 			     int y)
 {
-  return *bath_at(self, x, y);
+  return Matrix_get(self->_mat,
+		    CrystalModel_x_bath_to_model_rep(self, x),
+		    CrystalModel_y_bath_to_model_rep(self, y));
 }
 
 extern void
 CrystalModel_reset(CrystalModel *self)
 {
   Matrix_clear(self->_mat);
-  *bath_at(self, 0, 0) = 1;
+  if (self->_prox) {
+    Matrix_clear(self->_prox);
+  }
+  if (self->_sites) {
+    Matrix_clear(self->_sites);
+  }
+  self->_eden.n = 0;
+  self->_r_max = 0;
+  self->_steps = 0;
+  self->_escapes = 0;
+  self->_ions = 0;
+  self->_retries = 0;
+#ifdef CRYSTAL_STATS
+  memset(&self->_stats, 0, sizeof(self->_stats));
+  self->_stats.enabled = 1;
+  self->_stats.radius_bin = self->_r_start / CRYSTAL_STATS_BINS + 1;
+#endif
+  clear_cluster(self);
+  __atomic_store_n(&self->_log.count, 0, __ATOMIC_RELEASE);
+  update_radii(self);
+  if (self->_lattice == CRYSTAL_LATTICE_OFF) {
+    crystal_off_reset(self);
+  }
+  crystal_stick_ion(self, 0, 0);
+  self->_p.x = 0;
+  self->_p.y = 0;
+  self->_batch.live = 0;
+  self->_walking = 0;
+}
+
+extern void
+CrystalModel_set_launch_mode(CrystalModel *self,
+			     CrystalLaunchMode mode)
+{
+  self->_launch_mode = mode;
+  update_radii(self);
+}
+
+extern void
+CrystalModel_set_long_jumps(CrystalModel *self,
+			    int enabled)
+{
+  self->_long_jumps = enabled;
+  if (enabled && !self->_prox) {
+    create_proximity(self);
+    rebuild_proximity(self);
+  }
+  select_kernel(self);
 }
 
 extern unsigned
@@ -102,6 +559,100 @@ CrystalModel_y_bath_to_model_rep(CrystalModel const *self,
   return Matrix_size(self->_mat)/2 - y;
 }
 
+/*
+ * The batched kernel keeps BATCH_LANES walkers in flight and uses plain
+ * single steps; long jumps only apply to the scalar kernel, which also
+ * stands in for the integer kernel with them.
+ */
+extern void
+CrystalModel_set_kernel(CrystalModel *self,
+			CrystalKernel kernel)
+{
+  self->_kernel = kernel;
+  self->_batch.live = 0;
+  self->_walking = 0;
+  select_kernel(self);
+}
+
+extern void
+CrystalModel_set_escape_mode(CrystalModel *self,
+			     CrystalEscapeMode mode)
+{
+  self->_escape_mode = mode;
+}
+
+extern void
+CrystalModel_set_lattice(CrystalModel *self,
+			 CrystalLattice lattice)
+{
+  self->_lattice = lattice;
+  build_neighbours(self);
+  /* Off the lattice walkers always jump, by the proximity of the rounded centres. */
+  if (lattice == CRYSTAL_LATTICE_OFF && !self->_prox) {
+    create_proximity(self);
+  }
+  select_kernel(self);
+  CrystalModel_reset(self);
+}
+
+extern CrystalLattice
+CrystalModel_get_lattice(CrystalModel const *self)
+{
+  return self->_lattice;
+}
+
+extern void
+CrystalModel_get_position(CrystalModel const *self,
+			  int x,
+			  int y,
+			  double *px,
+			  double *py)
+{
+  crystal_site_position(self->_lattice, x, y, px, py);
+}
+
+extern void
+CrystalModel_get_site(CrystalModel const *self,
+		      double px,
+		      double py,
+		      int *x,
+		      int *y)
+{
+  Point const p = crystal_site_at(self->_lattice, px, py);
+  *x = p.x;
+  *y = p.y;
+}
+
+extern double
+CrystalModel_get_site_width(CrystalModel const *self)
+{
+  return self->_lattice == CRYSTAL_LATTICE_HEX ? CRYSTAL_HEX_WIDTH : 1;
+}
+
+extern void
+CrystalModel_set_rule(CrystalModel *self,
+		      CrystalRule rule,
+		      double param)
+{
+  self->_rule = rule;
+  self->_stick_p = rule == CRYSTAL_RULE_STICKY ? param : 1;
+  self->_hits = rule == CRYSTAL_RULE_NOISE ? (unsigned)fmin(fmax(param, 1), 255) : 1;
+  if ((rule == CRYSTAL_RULE_NOISE || rule == CRYSTAL_RULE_EDEN) && !self->_sites) {
+    /* Hit counts need whole bytes, sparse baths keep a sparse map. */
+    self->_sites = Matrix_create_with_layout(Matrix_size(self->_mat),
+					     Matrix_layout(self->_mat) == MATRIX_LAYOUT_SPARSE ?
+					     MATRIX_LAYOUT_SPARSE : MATRIX_LAYOUT_BYTES);
+  }
+  select_kernel(self);
+  CrystalModel_reset(self);
+}
+
+extern CrystalRule
+CrystalModel_get_rule(CrystalModel const *self)
+{
+  return self->_rule;
+}
+
 extern int
 CrystalModel_get_x(CrystalModel const *self)
 {
@@ -126,12 +677,172 @@ CrystalModel_get_radius(CrystalModel const *self)
   return self->_r_escape;
 }
 
+extern unsigned
+CrystalModel_get_crystal_radius(CrystalModel const *self)
+{
+  return self->_r_max;
+}
+
+/*
+ * One pass over the ions by distance accumulates the mass within each
+ * radius, for both the histogram and the least squares fit of log mass
+ * over log radius.
+ */
+extern void
+CrystalModel_get_cluster_stats(CrystalModel const *self,
+			       ClusterStats *stats)
+{
+  double const n = (double)self->_cluster.n;
+  int const hex = self->_lattice == CRYSTAL_LATTICE_HEX;
+  int const off = self->_lattice == CRYSTAL_LATTICE_OFF;
+  double const r2 = off ? self->_off.sum_r2 / n :
+    (ldexp((double)self->_cluster.sum_r2_hi, 64) +
+     (double)self->_cluster.sum_r2_lo) / n / (hex ? 3 : 1);
+  /* Off the lattice the farthest disc may lie a little beyond its rounded centre. */
+  unsigned const r_max = off ? (unsigned)ceil(self->_off.r_max) : self->_r_max;
+  unsigned const top = r_max < self->_cluster.mass_size ?
+    r_max : self->_cluster.mass_size - 1;
+  unsigned const fit_max = r_max / 2;
+  double next = FIT_R_MIN, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  uint64_t mass = 0;
+  unsigned k = 0;
+  int bin = 0;
+
+  memset(stats, 0, sizeof(*stats));
+  stats->ions = self->_cluster.n;
+  if (off) {
+    stats->centre_x = self->_off.sum_x / n;
+    stats->centre_y = self->_off.sum_y / n;
+  } else {
+    stats->centre_x = self->_cluster.sum_x / n * (hex ? CRYSTAL_HEX_WIDTH / 2 : 1);
+    stats->centre_y = self->_cluster.sum_y / n;
+  }
+  stats->rg = sqrt(fmax(0, r2 - stats->centre_x*stats->centre_x -
+			stats->centre_y*stats->centre_y));
+  stats->r_max = r_max;
+  stats->radius_bin = r_max / CLUSTER_STATS_BINS + 1;
+  for (unsigned r = 0; r <= top; ++r) {
+    mass += self->_cluster.mass[r];
+    if (r == (bin + 1) * stats->radius_bin) {
+      stats->mass[bin++] = mass;
+    }
+    if (r >= next && r <= fit_max) {
+      double const x = log(r), y = log(mass);
+      sx += x; sy += y; sxx += x*x; sxy += x*y;
+      ++k;
+      while (next <= r) {
+	next *= exp2(1.0 / FIT_STEPS);
+      }
+    }
+  }
+  for (; bin < CLUSTER_STATS_BINS; ++bin) {
+    stats->mass[bin] = mass;
+  }
+  if (k >= 3) {
+    stats->fractal_dimension = (k*sxy - sx*sy) / (k*sxx - sx*sx);
+  }
+}
+
+extern void
+CrystalModel_set_ion_log(CrystalModel *self,
+			 int enabled)
+{
+  int const r = (int)self->_r_max;
+
+  if (enabled && !self->_log.enabled) {
+    /* Ions that stuck before are logged in raster order. */
+    __atomic_store_n(&self->_log.count, 0, __ATOMIC_RELEASE);
+    for (int y = r; y >= -r; --y) {
+      for (int x = -r; x <= r; ++x) {
+	if (CrystalModel_get_model_value(self, x, y)) {
+	  crystal_log_ion(self, x, y);
+	}
+      }
+    }
+  }
+  self->_log.enabled = enabled;
+}
+
+extern int
+CrystalModel_get_ion_log(CrystalModel const *self)
+{
+  return self->_log.enabled;
+}
+
+extern uint64_t
+CrystalModel_get_logged_ions(CrystalModel const *self)
+{
+  return __atomic_load_n(&self->_log.count, __ATOMIC_ACQUIRE);
+}
+
+extern Point
+CrystalModel_get_logged_ion(CrystalModel const *self,
+			    uint64_t i)
+{
+  unsigned const k = 63 - __builtin_clzll((i >> ION_LOG_SHIFT) + 1);
+  return self->_log.chunks[k][i - (((UINT64_C(1) << k) - 1) << ION_LOG_SHIFT)];
+}
+
+extern void
+CrystalModel_get_stats(CrystalModel const *self,
+		       CrystalStats *stats)
+{
+#ifdef CRYSTAL_STATS
+  *stats = self->_stats;
+#else
+  (void)self;
+  memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+extern uint64_t
+CrystalModel_get_escapes(CrystalModel const *self)
+{
+  return self->_escapes;
+}
+
+extern uint64_t
+CrystalModel_get_steps(CrystalModel const *self)
+{
+  return self->_steps;
+}
+
+extern uint64_t
+CrystalModel_get_ions(CrystalModel const *self)
+{
+  return self->_ions;
+}
+
+extern uint64_t
+CrystalModel_get_retries(CrystalModel const *self)
+{
+  return self->_retries;
+}
+
+extern unsigned
+CrystalModel_get_launch_radius(CrystalModel const *self)
+{
+  return self->_r_launch;
+}
+
+extern unsigned
+CrystalModel_get_kill_radius(CrystalModel const *self)
+{
+  return self->_r_kill;
+}
+
 extern unsigned
 CrystalModel_get_bath_width(CrystalModel const *self)
 {
   return Matrix_size(self->_mat);
 }
 
+extern Matrix const *
+CrystalModel_get_bath(CrystalModel const *self)
+{
+  return self->_mat;
+}
+
 extern int
 CrystalModel_run_some_steps(CrystalModel *self,
 			    unsigned steps)
@@ -140,16 +851,53 @@ CrystalModel_run_some_steps(CrystalModel *self,
     if (!CrystalModel_crystallize_one_ion(self)) {
       return 0;
     }
+    if (crystal_limit_reached(self, self->_steps)) {
+      break;
+    }
   }
   return 1;
 }
 
+extern int
+CrystalModel_run_budget(CrystalModel *self,
+			CrystalBudget const *budget,
+			unsigned threads,
+			CrystalProgress *progress)
+{
+  uint64_t const ions = self->_ions;
+  uint64_t const steps = walked_steps(self);
+  CrystalLimit limit;
+  int more;
+
+  limit.end_steps = budget->max_steps ? steps + budget->max_steps : UINT64_MAX;
+  limit.deadline = budget->max_seconds > 0 ? crystal_time() + budget->max_seconds : 0;
+  limit.cancel = budget->cancel;
+  limit.reached = 0;
+  self->_limit = &limit;
+  if (crystal_limit_reached(self, steps)) {
+    more = 1;
+  } else {
+    more = CrystalModel_run_parallel(self, budget->max_ions ? budget->max_ions : UINT_MAX,
+				     threads);
+  }
+  self->_limit = NULL;
+  if (progress) {
+    progress->ions = self->_ions - ions;
+    progress->steps = walked_steps(self) - steps;
+    progress->interrupted = limit.reached;
+  }
+  return more;
+}
+
 extern void
 CrystalModel_srand(CrystalModel *self,
-		   unsigned seed)
+		   uint64_t seed)
 {
-  (void)self;
-  cs_srand(seed);
+  self->_seed = seed;
+  cs_rand_seed(&self->_walker.rng, seed);
+  self->_walker.n_dirs = 0;
+  self->_batch.live = 0;
+  self->_walking = 0;
 }
 
 extern char const *
@@ -159,14 +907,20 @@ CrystalModel_to_string(CrystalModel const *self)
   int const x = CrystalModel_get_x(self), y = CrystalModel_get_y(self);
   long const size = CrystalModel_get_radius(self);
   char *s = self->_s;
-  
+
+  /* The buffer is a cache, allocated when a picture is first asked for. */
+  if (!s) {
+    s = (char *)malloc((2*size+2)*(2*size+3) + 1);
+    ((CrystalModel *)self)->_s = s;
+  }
   for(i = -(size+1); i < size+1; i++) {
     *s++ = '-';
   }
   *s++ = '\n';
-  for(i = -size; i < size; i++) {
+  /* Top row first, so that the bath is read in its row-major order. */
+  for(j = size-1; j >= -size; j--) {
     *s++ = '|';
-    for(j = -size; j < size; j++) {
+    for(i = -size; i < size; i++) {
       if (CrystalModel_get_model_value(self, i, j)) {
 	*s++ = (i == x && j == y) ? '#' : '*';
       } else {
@@ -180,49 +934,398 @@ CrystalModel_to_string(CrystalModel const *self)
     *s++ = '-';
   }
   *s++ = '\n';
+  *s = '\0';
   return self->_s;
 }
 
-static int
-outside_circle(unsigned rEscape,
-	       Point const *p)
+extern void
+crystal_begin_ion(CrystalModel const *self,
+		  CrystalWalker *w,
+		  uint64_t ion)
+{
+  cs_rand_seed_stream(&w->rng, self->_seed, ion);
+  w->n_dirs = 0;
+  w->r_launch = self->_r_launch;
+  w->r_kill = self->_r_kill;
+  w->steps = 0;
+  w->escapes = 0;
+  CRYSTAL_STAT(w->checks = 0);
+  CRYSTAL_STAT(w->seconds = 0);
+}
+
+extern int
+crystal_any_neighbours(CrystalModel const *self,
+		       Point const *p)
+{
+  if (Matrix_has_halo(self->_mat)) {
+    return Matrix_get_halo(self->_mat,
+			   CrystalModel_x_bath_to_model_rep(self, p->x),
+			   CrystalModel_y_bath_to_model_rep(self, p->y));
+  }
+  return (CrystalModel_get_model_value(self, p->x+crystal_dp[0].x, p->y+crystal_dp[0].y) ||
+	  CrystalModel_get_model_value(self, p->x+crystal_dp[1].x, p->y+crystal_dp[1].y) ||
+	  CrystalModel_get_model_value(self, p->x+crystal_dp[2].x, p->y+crystal_dp[2].y) ||
+	  CrystalModel_get_model_value(self, p->x+crystal_dp[3].x, p->y+crystal_dp[3].y));
+}
+
+extern void
+crystal_drop_new_ion(CrystalWalker *w,
+		     Point *p)
+{
+  crystal_launch_point(w->r_launch, cs_rand(&w->rng) >> 11, p);
+}
+
+extern void
+crystal_launch_point(unsigned r,
+		     uint64_t u,
+		     Point *p)
+{
+  double alpha = 2 * M_PI * (u * 0x1.0p-53);
+  p->x = (int)(r*cos(alpha));
+  p->y = (int)(r*sin(alpha));
+}
+
+extern void
+crystal_escape(CrystalModel const *self,
+	       CrystalWalker *w,
+	       Point *p)
 {
-  return (unsigned)sqrt(p->x*p->x + p->y*p->y) >= rEscape;
+  double x = p->x, y = p->y;
+
+  if (self->_escape_mode == CRYSTAL_ESCAPE_RETURN) {
+    return_to_launch_circle(self, w, &x, &y);
+    p->x = (int)lround(x);
+    p->y = (int)lround(y);
+  } else {
+    crystal_drop_new_ion(w, p);
+  }
 }
 
+/*
+ * A walker at distance rho outside a disc of radius R hits the circle
+ * with the Poisson kernel P(theta) = (1-a^2) / (2pi (1+a^2-2a cos theta)),
+ * a = R/rho, theta measured from the walker's own angle. Its inverse is
+ * theta = 2 atan(c t) with c = (1-a)/(1+a) and t standard Cauchy, so
+ * with t from a quantile table cos/sin of theta are rational in c t.
+ * Takes and gives positions in the plane.
+ */
+static void
+return_to_launch_circle(CrystalModel const *self,
+			CrystalWalker *w,
+			double *x,
+			double *y)
+{
+  double const r = w->r_launch;
+  double const rho = sqrt(*x * *x + *y * *y);
+  double const a = r / rho;
+  double const ct = (1 - a) / (1 + a) * self->_cauchy[cs_rand(&w->rng) >> (64 - RETURN_TABLE_BITS)];
+  double const ct2 = ct * ct;
+  double const cos_t = (1 - ct2) / (1 + ct2);
+  double const sin_t = 2 * ct / (1 + ct2);
+  double const cos_p = *x / rho, sin_p = *y / rho;
+
+  *x = r * (cos_p*cos_t - sin_p*sin_t);
+  *y = r * (sin_p*cos_t + cos_p*sin_t);
+}
+
+/*
+ * Starts a ballistic walker on a line of uniform direction whose offset
+ * from the seed is uniform within the launch radius, where the line
+ * enters the launch circle.
+ */
+static void
+launch_ballistic(CrystalWalker *w,
+		 Point *p,
+		 CrystalLattice lattice)
+{
+  double const alpha = 2 * M_PI * cs_drand(&w->rng);
+  double const b = w->r_launch * (2 * cs_drand(&w->rng) - 1);
+  double const back = sqrt((double)w->r_launch * w->r_launch - b*b);
+
+  w->ux = cos(alpha);
+  w->uy = sin(alpha);
+  w->ox = -b * w->uy - back * w->ux;
+  w->oy = b * w->ux - back * w->uy;
+  if (lattice == CRYSTAL_LATTICE_HEX) {
+    *p = crystal_site_at(lattice, w->ox, w->oy);
+  } else {
+    p->x = (int)lround(w->ox);
+    p->y = (int)lround(w->oy);
+  }
+}
+
+/*
+ * Moves the walker to a uniformly random point on the largest circle
+ * around it that is known to contain no part of the crystal, or returns
+ * 0 if the walker is too close to the crystal and has to step instead.
+ */
 static int
-any_neighbours(CrystalModel const *self,
-	       Point const *p)
+jump_once(CrystalModel const *self,
+	  CrystalWalker *w,
+	  Point *p)
 {
-  return (CrystalModel_get_model_value(self, p->x+dp[0].x, p->y+dp[0].y) ||
-	  CrystalModel_get_model_value(self, p->x+dp[1].x, p->y+dp[1].y) ||
-	  CrystalModel_get_model_value(self, p->x+dp[2].x, p->y+dp[2].y) ||
-	  CrystalModel_get_model_value(self, p->x+dp[3].x, p->y+dp[3].y));
+  int d = DIST_CAP - bath_at_prox(self, p->x, p->y);
+  if (d == DIST_CAP) {
+    int d_far = (int)sqrt((double)p->x*p->x + (double)p->y*p->y) - (int)self->_r_max - 1;
+    if (d_far > d) {
+      d = d_far;
+    }
+  }
+  /* Keep a margin for rounding to the lattice so the walker never lands
+     on or next to the crystal. */
+  int const r = d - 2;
+  if (r < MIN_JUMP) {
+    return 0;
+  }
+  double alpha = 2 * M_PI * cs_drand(&w->rng);
+  p->x += (int)lround(r*cos(alpha));
+  p->y += (int)lround(r*sin(alpha));
+  return 1;
+}
+
+extern void
+crystal_stick_ion(CrystalModel *self,
+		  int x,
+		  int y)
+{
+  Point const p = { x, y };
+  unsigned r = (unsigned)ceil(crystal_site_radius(self->_lattice, &p));
+  int const odd = y & 1;
+  /* On HEX the sums are kept in half sites across, 3 r^2 being an integer. */
+  int64_t const sx = self->_lattice == CRYSTAL_LATTICE_HEX ? 2 * (int64_t)x + odd : x;
+  int64_t const sy2 = self->_lattice == CRYSTAL_LATTICE_HEX ? 3 * (int64_t)y*y : (int64_t)y*y;
+  uint64_t r2;
+  /* A walker launched onto the crystal sticks where it is, nothing changes. */
+  if (Matrix_get(self->_mat,
+		 CrystalModel_x_bath_to_model_rep(self, x),
+		 CrystalModel_y_bath_to_model_rep(self, y))) {
+    self->_ions++;
+    return;
+  }
+  Matrix_set(self->_mat,
+	     CrystalModel_x_bath_to_model_rep(self, x),
+	     CrystalModel_y_bath_to_model_rep(self, y),
+	     1);
+  if (Matrix_has_halo(self->_mat)) {
+    for (unsigned k = 0; k < self->_nb.n; ++k) {
+      Matrix_set_halo(self->_mat,
+		      CrystalModel_x_bath_to_model_rep(self, x + self->_nb.dp[odd][k].x),
+		      CrystalModel_y_bath_to_model_rep(self, y + self->_nb.dp[odd][k].y));
+    }
+  }
+  self->_ions++;
+  /* Off the lattice the discs are counted at their exact centres instead. */
+  if (self->_lattice != CRYSTAL_LATTICE_OFF) {
+    self->_cluster.n++;
+    self->_cluster.sum_x += sx;
+    self->_cluster.sum_y += y;
+    r2 = (uint64_t)(sx*sx + sy2);
+    self->_cluster.sum_r2_lo += r2;
+    self->_cluster.sum_r2_hi += self->_cluster.sum_r2_lo < r2;
+    self->_cluster.mass[r < self->_cluster.mass_size ? r : self->_cluster.mass_size - 1]++;
+  }
+  if (r > self->_r_max) {
+    self->_r_max = r;
+    update_radii(self);
+  }
+  if (self->_prox) {
+    update_proximity(self, x, y);
+  }
+  if (self->_log.enabled) {
+    crystal_log_ion(self, x, y);
+  }
+  if (self->_rule == CRYSTAL_RULE_EDEN) {
+    crystal_eden_add_perimeter(self, x, y);
+  }
 }
 
 static void
-drop_new_ion(unsigned r_start,
-	     Point *p)
+update_proximity(CrystalModel *self,
+		 int x,
+		 int y)
 {
-  double alpha = 2 * M_PI * cs_drand();
-  p->x = (int)(r_start*cos(alpha));
-  p->y = (int)(r_start*sin(alpha));
+  int const size = Matrix_size(self->_prox);
+  int const cx = CrystalModel_x_bath_to_model_rep(self, x);
+  int const cy = CrystalModel_y_bath_to_model_rep(self, y);
+  int const x0 = cx - DIST_CAP < 0 ? 0 : cx - DIST_CAP;
+  int const x1 = cx + DIST_CAP >= size ? size - 1 : cx + DIST_CAP;
+  int const y0 = cy - DIST_CAP < 0 ? 0 : cy - DIST_CAP;
+  int const y1 = cy + DIST_CAP >= size ? size - 1 : cy + DIST_CAP;
+
+  for (int j = y0; j <= y1; ++j) {
+    matrix_t const *stencil = self->_prox_stencil[j-cy+DIST_CAP];
+    for (int i = x0; i <= x1; ++i) {
+      if (stencil[i-cx+DIST_CAP] > Matrix_get(self->_prox, i, j)) {
+	Matrix_set(self->_prox, i, j, stencil[i-cx+DIST_CAP]);
+      }
+    }
+  }
 }
 
 static void
-step_once(Point *p)
+create_proximity(CrystalModel *self)
 {
-  Point const *d = &dp[cs_rand() & 3];
-  p->x += d->x;
-  p->y += d->y;
+  /* Sparse baths get a sparse proximity map, it only covers the crystal. */
+  self->_prox = Matrix_create_with_layout(Matrix_size(self->_mat),
+					  Matrix_layout(self->_mat) == MATRIX_LAYOUT_SPARSE ?
+					  MATRIX_LAYOUT_SPARSE : MATRIX_LAYOUT_BYTES);
+}
+
+static void
+rebuild_proximity(CrystalModel *self)
+{
+  int const size = Matrix_size(self->_mat);
+  /* Only the disc of radius r_max can hold ions. */
+  int const lo = size/2 - (int)self->_r_max - 1 < 0 ? 0 : size/2 - (int)self->_r_max - 1;
+  int const hi = size/2 + (int)self->_r_max + 1 >= size ? size - 1 : size/2 + (int)self->_r_max + 1;
+  Matrix_clear(self->_prox);
+  for (int j = lo; j <= hi; ++j) {
+    for (int i = lo; i <= hi; ++i) {
+      if (Matrix_get(self->_mat, i, j)) {
+	update_proximity(self,
+			 i - size/2,
+			 size/2 - j);
+      }
+    }
+  }
+}
+
+static void
+select_kernel(CrystalModel *self)
+{
+  int const jumps = self->_long_jumps;
+
+  if (self->_lattice == CRYSTAL_LATTICE_OFF) {
+    self->_crystallize = crystal_off_crystallize_one_ion;
+    return;
+  }
+  if (self->_rule == CRYSTAL_RULE_EDEN) {
+    self->_crystallize = crystal_eden_crystallize_one_ion;
+  } else if (self->_lattice != CRYSTAL_LATTICE_SQUARE) {
+    self->_crystallize = walk_kernels[self->_rule][self->_lattice == CRYSTAL_LATTICE_SQUARE8 ? 2 : 3];
+  } else if (self->_rule == CRYSTAL_RULE_DLA && self->_kernel == CRYSTAL_KERNEL_BATCH) {
+    self->_crystallize = crystal_batch_crystallize_one_ion;
+  } else if (self->_rule == CRYSTAL_RULE_DLA && self->_kernel == CRYSTAL_KERNEL_INTEGER &&
+	     !jumps && crystal_integer_bath(self->_mat)) {
+    self->_crystallize = crystal_integer_crystallize_one_ion;
+  } else {
+    self->_crystallize = walk_kernels[self->_rule][jumps != 0];
+  }
+}
+
+/*
+ * Offsets of the neighbours on the lattice, model y upwards: HEX rows
+ * are shifted right on odd y, so their neighbours above and below lie
+ * one column further right than on even y.
+ */
+static void
+build_neighbours(CrystalModel *self)
+{
+  static Point const square8[8] = {
+    {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {-1, 1}, {1, -1}, {-1, -1}
+  };
+  static Point const hex[2][6] = {
+    { {1, 0}, {-1, 0}, {-1, 1}, {0, 1}, {-1, -1}, {0, -1} },
+    { {1, 0}, {-1, 0}, {0, 1}, {1, 1}, {0, -1}, {1, -1} }
+  };
+  ptrdiff_t const stride = Matrix_stride(self->_mat);
+  CrystalNeighbours *nb = &self->_nb;
+
+  for (int odd = 0; odd < 2; ++odd) {
+    switch (self->_lattice) {
+    case CRYSTAL_LATTICE_SQUARE8:
+      nb->n = 8;
+      memcpy(nb->dp[odd], square8, sizeof(square8));
+      break;
+    case CRYSTAL_LATTICE_HEX:
+      nb->n = 6;
+      memcpy(nb->dp[odd], hex[odd], sizeof(hex[odd]));
+      break;
+    default:
+      nb->n = 4;
+      memcpy(nb->dp[odd], crystal_dp, sizeof(crystal_dp));
+      break;
+    }
+    /* Bath rows run downwards. */
+    for (unsigned k = 0; k < nb->n; ++k) {
+      nb->di[odd][k] = nb->dp[odd][k].x - nb->dp[odd][k].y * stride;
+    }
+  }
+}
+
+/*
+ * In adaptive mode walkers are launched just outside the crystal and
+ * killed at KILL_FACTOR times the launch radius, never exceeding the
+ * fixed radii themselves.
+ */
+static void
+update_radii(CrystalModel *self)
+{
+  unsigned r_launch, r_kill;
+  if (self->_launch_mode == CRYSTAL_LAUNCH_FIXED) {
+    self->_r_launch = self->_r_start;
+    self->_r_kill = self->_r_escape;
+    return;
+  }
+  r_launch = self->_r_max + LAUNCH_MARGIN;
+  if (r_launch > self->_r_start) {
+    r_launch = self->_r_start;
+  }
+  r_kill = KILL_FACTOR * r_launch;
+  if (r_kill > self->_r_escape) {
+    r_kill = self->_r_escape;
+  }
+  self->_r_launch = r_launch;
+  self->_r_kill = r_kill;
+}
+
+/* The mass-radius counts cover the escape circle, larger radii share the last. */
+static void
+clear_cluster(CrystalModel *self)
+{
+  uint64_t *mass = self->_cluster.mass;
+  unsigned const size = self->_r_escape + 2;
+
+  if (!mass) {
+    mass = (uint64_t *)malloc(size * sizeof(uint64_t));
+  }
+  memset(&self->_cluster, 0, sizeof(self->_cluster));
+  memset(mass, 0, size * sizeof(uint64_t));
+  self->_cluster.mass = mass;
+  self->_cluster.mass_size = size;
+}
+
+/* Steps of the stuck ions and of a walk interrupted by a limit. */
+static uint64_t
+walked_steps(CrystalModel const *self)
+{
+  return self->_steps + (self->_walking ? self->_walker.steps : 0);
+}
+
+/* The entry is written before the count that publishes it. */
+extern void
+crystal_log_ion(CrystalModel *self,
+		int x,
+		int y)
+{
+  uint64_t const i = self->_log.count;
+  unsigned const k = 63 - __builtin_clzll((i >> ION_LOG_SHIFT) + 1);
+  uint64_t const first = ((UINT64_C(1) << k) - 1) << ION_LOG_SHIFT;
+  Point const p = { x, y };
+
+  if (!self->_log.chunks[k]) {
+    self->_log.chunks[k] = (Point *)malloc((sizeof(Point) << ION_LOG_SHIFT) << k);
+  }
+  self->_log.chunks[k][i - first] = p;
+  __atomic_store_n(&self->_log.count, i + 1, __ATOMIC_RELEASE);
 }
 
-static matrix_t *
-bath_at(CrystalModel const *self,
-	int x,
-	int y)
+static matrix_t
+bath_at_prox(CrystalModel const *self,
+	     int x,
+	     int y)
 {
-  return Matrix_at(self->_mat,
+  return Matrix_get(self->_prox,
 		   CrystalModel_x_bath_to_model_rep(self, x),
 		   CrystalModel_y_bath_to_model_rep(self, y));
 }
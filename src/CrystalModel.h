@@ -1,10 +1,52 @@
 #ifndef CRYSTAL_MODEL_H
 #define CRYSTAL_MODEL_H
 
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "ClusterStats.h"
+#include "CrystalStats.h"
 #include "Matrix.h"
+#include "Point.h"
 
 typedef struct crystal_model_t CrystalModel;
 
+typedef enum
+{
+  CRYSTAL_LAUNCH_FIXED,   /* launch at r_start, kill at r_escape */
+  CRYSTAL_LAUNCH_ADAPTIVE /* launch and kill radii follow the crystal */
+} CrystalLaunchMode;
+
+typedef enum
+{
+  CRYSTAL_ESCAPE_RELAUNCH, /* escaped walkers are replaced by new ones */
+  CRYSTAL_ESCAPE_RETURN    /* escaped walkers return to the launch circle */
+} CrystalEscapeMode;
+
+typedef enum
+{
+  CRYSTAL_KERNEL_SCALAR, /* one walker at a time */
+  CRYSTAL_KERNEL_BATCH,  /* several walkers in lockstep, SIMD when available */
+  CRYSTAL_KERNEL_INTEGER /* the scalar walk in integers on linear bath indices */
+} CrystalKernel;
+
+typedef enum
+{
+  CRYSTAL_LATTICE_SQUARE,  /* unit steps between the cells of the bath */
+  CRYSTAL_LATTICE_OFF,     /* discs of unit diameter stick on contact */
+  CRYSTAL_LATTICE_SQUARE8, /* ... and diagonal steps, 8 neighbours */
+  CRYSTAL_LATTICE_HEX      /* triangular lattice, 6 neighbours */
+} CrystalLattice;
+
+typedef enum
+{
+  CRYSTAL_RULE_DLA,       /* walkers stick next to the crystal */
+  CRYSTAL_RULE_STICKY,    /* ... with a sticking probability */
+  CRYSTAL_RULE_NOISE,     /* a site fills after a number of hits */
+  CRYSTAL_RULE_BALLISTIC, /* walkers follow straight lines */
+  CRYSTAL_RULE_EDEN       /* a random site of the perimeter fills */
+} CrystalRule;
+
 extern CrystalModel *
 CrystalModel_create(Matrix *mat,
 		    unsigned r_start,
@@ -19,12 +61,106 @@ CrystalModel_get_model_value(CrystalModel const *self,
 			     int y);
 extern void
 CrystalModel_reset(CrystalModel *self);
+/*
+ * Changes the launch and escape radii and resets the model, so that one
+ * model and bath can be reused for crystals of different sizes. The bath
+ * must be wider than 2 (r_escape + 1).
+ */
+extern void
+CrystalModel_set_radii(CrystalModel *self,
+		       unsigned r_start,
+		       unsigned r_escape);
+/*
+ * Lets walkers in open space jump across circles known to be free of
+ * the crystal instead of taking single steps.
+ */
+extern void
+CrystalModel_set_long_jumps(CrystalModel *self,
+			    int enabled);
 extern unsigned
 CrystalModel_x_bath_to_model_rep(CrystalModel const *self,
 				 int x);
 extern unsigned
 CrystalModel_y_bath_to_model_rep(CrystalModel const *self,
 				 int y);
+extern void
+CrystalModel_set_launch_mode(CrystalModel *self,
+			     CrystalLaunchMode mode);
+/*
+ * CRYSTAL_KERNEL_INTEGER grows the same crystal as CRYSTAL_KERNEL_SCALAR
+ * step for step. It needs a MATRIX_LAYOUT_BYTES or MATRIX_LAYOUT_BITS
+ * bath and no long jumps; otherwise the scalar kernel runs instead.
+ */
+extern void
+CrystalModel_set_kernel(CrystalModel *self,
+			CrystalKernel kernel);
+extern void
+CrystalModel_set_escape_mode(CrystalModel *self,
+			     CrystalEscapeMode mode);
+/*
+ * Switches between the lattice geometries and the off-lattice model and
+ * resets the model. Off the lattice the kernel and long jump settings
+ * are ignored and escaped walkers are always relaunched; every disc is
+ * also stuck into the bath at its rounded centre, which is what views,
+ * writers and the cluster statistics see.
+ *
+ * CRYSTAL_LATTICE_HEX stores its rows in the rows of the bath, odd rows
+ * shifted half a site to the right, with sites 2/sqrt(3) wide
+ * for rows 1 apart so that the radii keep their meaning. CRYSTAL_LATTICE_SQUARE8
+ * and CRYSTAL_LATTICE_HEX only run on the scalar kernel, without long
+ * jumps.
+ */
+extern void
+CrystalModel_set_lattice(CrystalModel *self,
+			 CrystalLattice lattice);
+extern CrystalLattice
+CrystalModel_get_lattice(CrystalModel const *self);
+/* Position of site (x, y) in the plane, in units of the row spacing. */
+extern void
+CrystalModel_get_position(CrystalModel const *self,
+			  int x,
+			  int y,
+			  double *px,
+			  double *py);
+/*
+ * The site whose cell holds (px, py): unit squares on the square
+ * lattices, bricks of their row on CRYSTAL_LATTICE_HEX.
+ */
+extern void
+CrystalModel_get_site(CrystalModel const *self,
+		      double px,
+		      double py,
+		      int *x,
+		      int *y);
+/* Width of a site in units of the row spacing. */
+extern double
+CrystalModel_get_site_width(CrystalModel const *self);
+/*
+ * Selects the growth rule and resets the model. `param` is the sticking
+ * probability in (0, 1] of CRYSTAL_RULE_STICKY and the hits a site needs,
+ * 1 to 255, under CRYSTAL_RULE_NOISE; walkers that hit a site short of
+ * that count are absorbed without filling it. Ballistic walkers follow a
+ * line of uniform direction and offset through the launch circle and
+ * ignore long jumps; Eden growth walks no ions at all. The rule is built
+ * into the kernel chosen here, other rules than CRYSTAL_RULE_DLA use the
+ * scalar kernel whatever CrystalModel_set_kernel asked for, and the
+ * lattice rules are ignored off the lattice.
+ */
+extern void
+CrystalModel_set_rule(CrystalModel *self,
+		      CrystalRule rule,
+		      double param);
+extern CrystalRule
+CrystalModel_get_rule(CrystalModel const *self);
+/* Number of discs of the off-lattice model, seed included. */
+extern uint64_t
+CrystalModel_get_discs(CrystalModel const *self);
+/* Centre of disc `i`, in sticking order. */
+extern void
+CrystalModel_get_disc(CrystalModel const *self,
+		      uint64_t i,
+		      double *x,
+		      double *y);
 extern int
 CrystalModel_get_x(CrystalModel const *self);
 extern int
@@ -33,15 +169,132 @@ extern unsigned
 CrystalModel_get_r_bounds(CrystalModel const *self);
 extern unsigned
 CrystalModel_get_radius(CrystalModel const *self);
+/* Distance of the farthest ion from the seed, rounded up. */
+extern unsigned
+CrystalModel_get_crystal_radius(CrystalModel const *self);
+extern uint64_t
+CrystalModel_get_steps(CrystalModel const *self);
+extern uint64_t
+CrystalModel_get_ions(CrystalModel const *self);
+extern unsigned
+CrystalModel_get_launch_radius(CrystalModel const *self);
+extern unsigned
+CrystalModel_get_kill_radius(CrystalModel const *self);
 extern unsigned
 CrystalModel_get_bath_width(CrystalModel const *self);
+/* The bath the crystal grows in, for views reading it directly. */
+extern Matrix const *
+CrystalModel_get_bath(CrystalModel const *self);
 extern int
 CrystalModel_run_some_steps(CrystalModel *self,
 			    unsigned steps);
+/*
+ * Like CrystalModel_run_some_steps but walks future ions speculatively on
+ * `threads` threads. Gives the same crystal as the serial scalar kernel
+ * for the same seed. Falls back to the serial path for the batched
+ * kernel, for long jumps, for rules other than CRYSTAL_RULE_DLA and off
+ * the square lattice.
+ */
+extern int
+CrystalModel_run_parallel(CrystalModel *self,
+			  unsigned steps,
+			  unsigned threads);
+/* Limits of one CrystalModel_run_budget call, zero fields do not limit. */
+typedef struct
+{
+  unsigned max_ions;
+  uint64_t max_steps;    /* walker steps */
+  double max_seconds;
+  int const *cancel;     /* stops the call once nonzero, may be set by any thread */
+} CrystalBudget;
+
+/* What one CrystalModel_run_budget call did. */
+typedef struct
+{
+  uint64_t ions;
+  uint64_t steps;
+  int interrupted;       /* stopped by max_steps, max_seconds or cancel */
+} CrystalProgress;
+
+/*
+ * Grows the crystal like CrystalModel_run_parallel until `budget` is
+ * spent. Time, steps and the cancel flag are checked every few thousand
+ * walker steps, so the call returns within milliseconds of a limit
+ * whatever the crystal size. A walk cut short continues where it stopped
+ * on the next call, giving the same crystal as an uninterrupted run;
+ * only speculative parallel walks beyond the next ion are redone. The
+ * parallel engine only checks max_steps as ions stick. Returns 0 once
+ * the crystal is complete, 1 otherwise.
+ */
+extern int
+CrystalModel_run_budget(CrystalModel *self,
+			CrystalBudget const *budget,
+			unsigned threads,
+			CrystalProgress *progress);
+/* Number of times walkers crossed the kill circle and were relaunched
+   or returned. */
+extern uint64_t
+CrystalModel_get_escapes(CrystalModel const *self);
+/*
+ * Copies the instrumentation counters, all zero unless built with
+ * CRYSTAL_STATS. Reset by CrystalModel_reset, not kept in checkpoints.
+ */
+extern void
+CrystalModel_get_stats(CrystalModel const *self,
+		       CrystalStats *stats);
+/*
+ * Fills in the shape of the crystal grown so far. The sums behind it are
+ * updated in constant time per ion; this call takes time linear in the
+ * crystal radius and can be made at any moment, e.g. to stop a run once
+ * the fractal dimension has converged.
+ */
+extern void
+CrystalModel_get_cluster_stats(CrystalModel const *self,
+			       ClusterStats *stats);
+/*
+ * Logs the position of every ion as it sticks, starting with the ions
+ * already in the crystal, for views that only draw what is new.
+ */
+extern void
+CrystalModel_set_ion_log(CrystalModel *self,
+			 int enabled);
+extern int
+CrystalModel_get_ion_log(CrystalModel const *self);
+/*
+ * Number of logged ions. May be called while another thread grows the
+ * crystal; the ions below the returned count can then be read. Drops
+ * back when the model is reset.
+ */
+extern uint64_t
+CrystalModel_get_logged_ions(CrystalModel const *self);
+extern Point
+CrystalModel_get_logged_ion(CrystalModel const *self,
+			    uint64_t i);
+/* Number of speculative walks that had to be redone. */
+extern uint64_t
+CrystalModel_get_retries(CrystalModel const *self);
 extern void
 CrystalModel_srand(CrystalModel *self,
-		   unsigned seed);
+		   uint64_t seed);
 extern char const *
 CrystalModel_to_string(CrystalModel const *self);
+/*
+ * Writes the complete state of the model, from which CrystalModel_load
+ * continues bit-exactly. Returns 0 on success, -1 on error.
+ */
+extern int
+CrystalModel_save(CrystalModel const *self,
+		  FILE *out);
+/*
+ * Restores a state written by CrystalModel_save into a model created
+ * with the same bath width and radii, including its launch, escape,
+ * kernel and long jump settings. Returns 0 on success, -1 on error.
+ * Only models growing by CRYSTAL_RULE_DLA on CRYSTAL_LATTICE_SQUARE
+ * can be saved, the loaded model is switched to them. A finished
+ * crystal stays finished, the run functions return 0 at once.
+ */
+extern int
+CrystalModel_load(CrystalModel *self,
+		  FILE *in);
 
 #endif /* CRYSTAL_MODEL_H */
@@ -0,0 +1,401 @@
+#include "CrystalModel3D.h"
+
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include "random.h"
+
+/* Distance between the crystal and the launch sphere. */
+#define LAUNCH_MARGIN 5
+/* Ratio between the kill and launch radii. */
+#define KILL_FACTOR 2
+/* Walkers only jump when the jump radius is at least this large. */
+#define MIN_JUMP 2
+/* Rounding a jump to the lattice moves a walker by up to sqrt(3)/2, so
+   jumps keep this far from the sphere holding the crystal. */
+#define JUMP_MARGIN 2
+/* Walkers check the limits of CrystalModel3D_run_budget this often. */
+#define CHECK_STEPS 4096
+/* Seed used until CrystalModel3D_srand is called. */
+#define DEFAULT_SEED 1
+
+typedef struct
+{
+  int x;
+  int y;
+  int z;
+} Point3D;
+
+typedef struct
+{
+  CsRandom rng;
+  uint64_t dirs;    /* unused 3-bit direction draws */
+  unsigned n_dirs;
+  unsigned r_launch;
+  unsigned r_kill;
+  uint64_t steps;
+  uint64_t escapes;
+  Point3D p;
+} Walker3D;
+
+/* Limits of the CrystalModel3D_run_budget call in progress. */
+typedef struct
+{
+  uint64_t end_steps;
+  double deadline;
+  int const *cancel;
+  int reached;
+} Limit3D;
+
+struct crystal_model_3d_t
+{
+  Volume *_vol;
+  unsigned _r_start;
+  unsigned _r_escape;
+  unsigned _r_max;
+  unsigned _r_launch;
+  unsigned _r_kill;
+  uint64_t _seed;
+  uint64_t _ions;
+  uint64_t _voxels;
+  uint64_t _steps;
+  uint64_t _escapes;
+  Point3D _last;
+  Walker3D _walker;
+  int _walking;     /* the walker was interrupted by a limit */
+  Limit3D *_limit;
+};
+
+static Point3D const dp[6] = {
+  { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+};
+
+static void
+launch(Walker3D *w);
+static void
+jump(Walker3D *w,
+     double r);
+static int
+any_neighbours(CrystalModel3D const *self,
+	       Point3D const *p);
+static void
+stick(CrystalModel3D *self,
+      Point3D const *p);
+static void
+update_radii(CrystalModel3D *self);
+static int
+limit_reached(CrystalModel3D *self,
+	      uint64_t steps);
+
+static inline unsigned
+next_direction(Walker3D *w)
+{
+  unsigned d;
+  do {
+    if (w->n_dirs == 0) {
+      w->dirs = cs_rand(&w->rng);
+      w->n_dirs = 21;
+    }
+    d = w->dirs & 7;
+    w->dirs >>= 3;
+    w->n_dirs--;
+  } while (d >= 6);
+  return d;
+}
+
+static inline uint64_t
+norm2(Point3D const *p)
+{
+  return (uint64_t)((int64_t)p->x*p->x + (int64_t)p->y*p->y + (int64_t)p->z*p->z);
+}
+
+extern CrystalModel3D *
+CrystalModel3D_create(Volume *vol,
+		      unsigned r_start,
+		      unsigned r_escape)
+{
+  CrystalModel3D *self = (CrystalModel3D *)calloc(1, sizeof(CrystalModel3D));
+
+  self->_vol = vol;
+  self->_r_start = r_start;
+  self->_r_escape = r_escape;
+  CrystalModel3D_srand(self, DEFAULT_SEED);
+  CrystalModel3D_reset(self);
+  return self;
+}
+
+extern void
+CrystalModel3D_destroy(CrystalModel3D *self)
+{
+  free(self);
+}
+
+extern void
+CrystalModel3D_reset(CrystalModel3D *self)
+{
+  Point3D const seed = { 0, 0, 0 };
+
+  Volume_clear(self->_vol);
+  self->_r_max = 0;
+  self->_ions = 0;
+  self->_voxels = 0;
+  self->_steps = 0;
+  self->_escapes = 0;
+  self->_walking = 0;
+  update_radii(self);
+  stick(self, &seed);
+}
+
+extern void
+CrystalModel3D_srand(CrystalModel3D *self,
+		     uint64_t seed)
+{
+  self->_seed = seed;
+  self->_walking = 0;
+}
+
+/*
+ * Walks the current ion until it sticks, or until a limit of
+ * CrystalModel3D_run_budget; the next call then continues the walk.
+ */
+extern int
+CrystalModel3D_crystallize_one_ion(CrystalModel3D *self)
+{
+  Walker3D *w = &self->_walker;
+  Point3D *p = &w->p;
+  uint64_t check;
+
+  if (self->_walking) {
+    self->_walking = 0;
+  } else {
+    /* Every ion walks on its own random stream, as in two dimensions. */
+    cs_rand_seed_stream(&w->rng, self->_seed, self->_ions);
+    w->n_dirs = 0;
+    w->r_launch = self->_r_launch;
+    w->r_kill = self->_r_kill;
+    w->steps = 0;
+    w->escapes = 0;
+    launch(w);
+  }
+  check = self->_limit ? w->steps + CHECK_STEPS : UINT64_MAX;
+  for (;;) {
+    uint64_t const r2 = norm2(p);
+    double far;
+    if (w->steps >= check) {
+      if (limit_reached(self, self->_steps + w->steps)) {
+	self->_walking = 1;
+	return 1;
+      }
+      check += CHECK_STEPS;
+    }
+    if (r2 >= (uint64_t)w->r_kill * w->r_kill) {
+      launch(w);
+      w->escapes++;
+      continue;
+    }
+    far = sqrt((double)r2) - self->_r_max - JUMP_MARGIN;
+    if (far >= MIN_JUMP) {
+      jump(w, far);
+    } else if (any_neighbours(self, p)) {
+      break;
+    } else {
+      Point3D const *d = &dp[next_direction(w)];
+      p->x += d->x;
+      p->y += d->y;
+      p->z += d->z;
+    }
+    w->steps++;
+  }
+  self->_steps += w->steps;
+  self->_escapes += w->escapes;
+  stick(self, p);
+  return norm2(p) < (uint64_t)self->_r_start * self->_r_start;
+}
+
+extern int
+CrystalModel3D_run_some_steps(CrystalModel3D *self,
+			      unsigned steps)
+{
+  while (steps-- > 0) {
+    if (!CrystalModel3D_crystallize_one_ion(self)) {
+      return 0;
+    }
+    if (limit_reached(self, self->_steps)) {
+      break;
+    }
+  }
+  return 1;
+}
+
+extern int
+CrystalModel3D_run_budget(CrystalModel3D *self,
+			  CrystalBudget const *budget,
+			  CrystalProgress *progress)
+{
+  uint64_t const ions = self->_ions;
+  uint64_t const steps = self->_steps + (self->_walking ? self->_walker.steps : 0);
+  Limit3D limit;
+  int more = 1;
+
+  limit.end_steps = budget->max_steps ? steps + budget->max_steps : UINT64_MAX;
+  limit.deadline = budget->max_seconds > 0 ? crystal_time() + budget->max_seconds : 0;
+  limit.cancel = budget->cancel;
+  limit.reached = 0;
+  self->_limit = &limit;
+  if (!limit_reached(self, steps)) {
+    more = CrystalModel3D_run_some_steps(self, budget->max_ions ? budget->max_ions : UINT_MAX);
+  }
+  self->_limit = NULL;
+  if (progress) {
+    progress->ions = self->_ions - ions;
+    progress->steps = self->_steps + (self->_walking ? self->_walker.steps : 0) - steps;
+    progress->interrupted = limit.reached;
+  }
+  return more;
+}
+
+extern int
+CrystalModel3D_get_model_value(CrystalModel3D const *self,
+			       int x,
+			       int y,
+			       int z)
+{
+  unsigned const half = Volume_size(self->_vol) / 2;
+  return Volume_get(self->_vol, x + half, y + half, z + half);
+}
+
+extern Volume const *
+CrystalModel3D_get_volume(CrystalModel3D const *self)
+{
+  return self->_vol;
+}
+
+extern void
+CrystalModel3D_get_last(CrystalModel3D const *self,
+			int *x,
+			int *y,
+			int *z)
+{
+  *x = self->_last.x;
+  *y = self->_last.y;
+  *z = self->_last.z;
+}
+
+extern unsigned
+CrystalModel3D_get_crystal_radius(CrystalModel3D const *self)
+{
+  return self->_r_max;
+}
+
+extern uint64_t
+CrystalModel3D_get_ions(CrystalModel3D const *self)
+{
+  return self->_ions;
+}
+
+extern uint64_t
+CrystalModel3D_get_voxels(CrystalModel3D const *self)
+{
+  return self->_voxels;
+}
+
+extern uint64_t
+CrystalModel3D_get_steps(CrystalModel3D const *self)
+{
+  return self->_steps;
+}
+
+extern uint64_t
+CrystalModel3D_get_escapes(CrystalModel3D const *self)
+{
+  return self->_escapes;
+}
+
+/* Uniform on the launch sphere, z and the azimuth being uniform. */
+static void
+launch(Walker3D *w)
+{
+  double const z = 2 * cs_drand(&w->rng) - 1;
+  double const phi = 2 * M_PI * cs_drand(&w->rng);
+  double const s = sqrt(1 - z*z);
+
+  w->p.x = (int)lround(w->r_launch * s * cos(phi));
+  w->p.y = (int)lround(w->r_launch * s * sin(phi));
+  w->p.z = (int)lround(w->r_launch * z);
+}
+
+/* To a uniform point of the sphere of radius `r` around the walker. */
+static void
+jump(Walker3D *w,
+     double r)
+{
+  double const z = 2 * cs_drand(&w->rng) - 1;
+  double const phi = 2 * M_PI * cs_drand(&w->rng);
+  double const s = sqrt(1 - z*z);
+
+  w->p.x += (int)lround(r * s * cos(phi));
+  w->p.y += (int)lround(r * s * sin(phi));
+  w->p.z += (int)lround(r * z);
+}
+
+static int
+any_neighbours(CrystalModel3D const *self,
+	       Point3D const *p)
+{
+  unsigned const half = Volume_size(self->_vol) / 2;
+  unsigned const x = p->x + half, y = p->y + half, z = p->z + half;
+
+  return (Volume_get(self->_vol, x + 1, y, z) || Volume_get(self->_vol, x - 1, y, z) ||
+	  Volume_get(self->_vol, x, y + 1, z) || Volume_get(self->_vol, x, y - 1, z) ||
+	  Volume_get(self->_vol, x, y, z + 1) || Volume_get(self->_vol, x, y, z - 1));
+}
+
+static void
+stick(CrystalModel3D *self,
+      Point3D const *p)
+{
+  unsigned const half = Volume_size(self->_vol) / 2;
+  unsigned const r = (unsigned)ceil(sqrt((double)norm2(p)));
+
+  self->_ions++;
+  self->_last = *p;
+  /* A walker launched onto the crystal sticks where it is, nothing changes. */
+  if (Volume_get(self->_vol, p->x + half, p->y + half, p->z + half)) {
+    return;
+  }
+  Volume_set(self->_vol, p->x + half, p->y + half, p->z + half);
+  self->_voxels++;
+  if (r > self->_r_max) {
+    self->_r_max = r;
+    update_radii(self);
+  }
+}
+
+static void
+update_radii(CrystalModel3D *self)
+{
+  unsigned r_launch = self->_r_max + LAUNCH_MARGIN;
+  if (r_launch > self->_r_start) {
+    r_launch = self->_r_start;
+  }
+  self->_r_launch = r_launch;
+  self->_r_kill = KILL_FACTOR * r_launch < self->_r_escape ? KILL_FACTOR * r_launch : self->_r_escape;
+}
+
+static int
+limit_reached(CrystalModel3D *self,
+	      uint64_t steps)
+{
+  Limit3D *l = self->_limit;
+
+  if (!l) {
+    return 0;
+  }
+  if (steps >= l->end_steps ||
+      (l->cancel && __atomic_load_n(l->cancel, __ATOMIC_RELAXED)) ||
+      (l->deadline > 0 && crystal_time() >= l->deadline)) {
+    l->reached = 1;
+  }
+  return l->reached;
+}
@@ -0,0 +1,72 @@
+#ifndef CRYSTAL_MODEL_3D_H
+#define CRYSTAL_MODEL_3D_H
+
+#include <inttypes.h>
+
+#include "CrystalModel.h"
+#include "Volume.h"
+
+/*
+ * Diffusion limited aggregation on the cubic lattice: walkers are
+ * launched on a sphere around the crystal, take steps to one of their 6
+ * neighbours and stick next to an occupied voxel. Launch and kill radii
+ * follow the crystal as in CRYSTAL_LAUNCH_ADAPTIVE, escaped walkers are
+ * relaunched, and walkers far from the crystal jump across the sphere
+ * around them that misses it. Growth stops once an ion sticks at
+ * r_start from the seed, as in two dimensions.
+ */
+typedef struct crystal_model_3d_t CrystalModel3D;
+
+/* The volume must be wider than 2 (r_escape + 1). */
+extern CrystalModel3D *
+CrystalModel3D_create(Volume *vol,
+		      unsigned r_start,
+		      unsigned r_escape);
+extern void
+CrystalModel3D_destroy(CrystalModel3D *self);
+extern void
+CrystalModel3D_reset(CrystalModel3D *self);
+extern void
+CrystalModel3D_srand(CrystalModel3D *self,
+		     uint64_t seed);
+extern int
+CrystalModel3D_crystallize_one_ion(CrystalModel3D *self);
+extern int
+CrystalModel3D_run_some_steps(CrystalModel3D *self,
+			      unsigned steps);
+/*
+ * Grows the crystal until `budget` is spent, like CrystalModel_run_budget
+ * with one thread. Returns 0 once the crystal is complete, 1 otherwise.
+ */
+extern int
+CrystalModel3D_run_budget(CrystalModel3D *self,
+			  CrystalBudget const *budget,
+			  CrystalProgress *progress);
+/* Coordinates are relative to the seed. */
+extern int
+CrystalModel3D_get_model_value(CrystalModel3D const *self,
+			       int x,
+			       int y,
+			       int z);
+extern Volume const *
+CrystalModel3D_get_volume(CrystalModel3D const *self);
+/* Position of the last ion. */
+extern void
+CrystalModel3D_get_last(CrystalModel3D const *self,
+			int *x,
+			int *y,
+			int *z);
+/* Distance of the farthest ion from the seed, rounded up. */
+extern unsigned
+CrystalModel3D_get_crystal_radius(CrystalModel3D const *self);
+extern uint64_t
+CrystalModel3D_get_ions(CrystalModel3D const *self);
+/* Occupied voxels, seed included. */
+extern uint64_t
+CrystalModel3D_get_voxels(CrystalModel3D const *self);
+extern uint64_t
+CrystalModel3D_get_steps(CrystalModel3D const *self);
+extern uint64_t
+CrystalModel3D_get_escapes(CrystalModel3D const *self);
+
+#endif /* CRYSTAL_MODEL_3D_H */
@@ -0,0 +1,392 @@
+#ifndef CRYSTAL_MODEL_PRIVATE_H_
+#define CRYSTAL_MODEL_PRIVATE_H_
+
+/*
+ * Internals of CrystalModel shared between the translation units that
+ * implement its walker kernels. Not to be included by views or controls.
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "CrystalModel.h"
+#include "CrystalStats.h"
+#include "Matrix.h"
+#include "Point.h"
+#include "random.h"
+
+/* Distances to the crystal are tracked up to DIST_CAP lattice units. */
+#define DIST_CAP 32
+/* log2 of the number of entries in the Cauchy quantile table. */
+#define RETURN_TABLE_BITS 12
+#define RETURN_TABLE_SIZE (1 << RETURN_TABLE_BITS)
+/* Number of walkers advanced together by the batched kernel. */
+#define BATCH_LANES 8
+/* The first chunk of the ion log holds 2^ION_LOG_SHIFT positions, every
+   further chunk twice as many as the one before. */
+#define ION_LOG_SHIFT 12
+#define ION_LOG_CHUNKS 40
+
+/* Sites of CRYSTAL_LATTICE_HEX are 2/sqrt(3) wide for rows 1 apart. */
+#define CRYSTAL_HEX_WIDTH 1.1547005383792515
+
+/* Walkers check the limits of CrystalModel_run_budget this often. */
+#define CRYSTAL_CHECK_STEPS 4096
+
+/* Instrumentation, compiled in with CRYSTAL_STATS only. */
+#ifdef CRYSTAL_STATS
+#define CRYSTAL_STAT(statement) statement
+#else
+#define CRYSTAL_STAT(statement)
+#endif
+
+/* State of one walker in flight: its random stream and the radii it uses. */
+typedef struct
+{
+  CsRandom rng;
+  uint64_t dirs;   /* unused step directions, 2 bits each */
+  unsigned n_dirs;
+  unsigned r_launch;
+  unsigned r_kill;
+  uint64_t steps;
+  uint64_t escapes; /* times the walker crossed the kill circle */
+  double ox;        /* line of a ballistic walker, through (ox, oy) along (ux, uy) */
+  double oy;
+  double ux;
+  double uy;
+#ifdef CRYSTAL_STATS
+  uint64_t checks;  /* neighbour checks */
+  double seconds;   /* spent in earlier, interrupted parts of the walk */
+#endif
+} CrystalWalker;
+
+/*
+ * Neighbours of a lattice site by the parity of its row, which only
+ * matters for the shifted odd rows of CRYSTAL_LATTICE_HEX. Also the step
+ * directions of the walkers.
+ */
+typedef struct
+{
+  unsigned n;
+  Point dp[2][8];
+  ptrdiff_t di[2][8];  /* the same in the cells of a MATRIX_LAYOUT_BYTES bath */
+} CrystalNeighbours;
+
+/* Limits of the CrystalModel_run_budget call in progress. */
+typedef struct
+{
+  uint64_t end_steps;  /* model steps, including the walk in flight */
+  double deadline;     /* crystal_time(), 0 for none */
+  int const *cancel;
+  int reached;         /* set atomically, workers may race on it */
+} CrystalLimit;
+
+struct crystal_model_t
+{
+  Matrix *_mat;
+  Point _p;
+  unsigned _r_start;
+  unsigned _r_escape;
+  unsigned _r_max;
+  unsigned _r_launch;
+  unsigned _r_kill;
+  CrystalLaunchMode _launch_mode;
+  CrystalEscapeMode _escape_mode;
+  CrystalKernel _kernel;
+  CrystalLattice _lattice;
+  CrystalNeighbours _nb;
+  CrystalRule _rule;
+  /* Kernel for the lattice, rule, kernel and long jump settings. */
+  int (*_crystallize)(CrystalModel *self);
+  char *_s;
+  uint64_t _steps;
+  uint64_t _ions;
+  uint64_t _retries;
+  uint64_t _escapes;
+
+  uint64_t _seed;
+  CrystalWalker _walker;
+  /* The scalar walker was interrupted by a limit at _walk_p. */
+  int _walking;
+  Point _walk_p;
+  CrystalLimit *_limit;
+
+  int _long_jumps;
+  Matrix *_prox;
+  matrix_t _prox_stencil[2*DIST_CAP+1][2*DIST_CAP+1];
+
+  double _cauchy[RETURN_TABLE_SIZE];
+
+  /* Walkers of the batched kernel, structure of arrays. */
+  struct {
+    int32_t x[BATCH_LANES];
+    int32_t y[BATCH_LANES];
+    int32_t idx[BATCH_LANES];
+    int live; /* lanes hold walkers of the current run and seed */
+#ifdef CRYSTAL_STATS
+    uint64_t launch_steps[BATCH_LANES]; /* model steps at launch */
+    uint32_t escapes[BATCH_LANES];
+#endif
+  } _batch;
+#ifdef CRYSTAL_STATS
+  CrystalStats _stats;
+#endif
+  /* Sums over the stuck ions, exact whatever the order they stuck in. */
+  struct {
+    uint64_t n;
+    int64_t sum_x;
+    int64_t sum_y;
+    uint64_t sum_r2_lo; /* sum of x^2 + y^2, 128 bits wide */
+    uint64_t sum_r2_hi;
+    uint64_t *mass;     /* ions by ceil(distance to the seed) */
+    unsigned mass_size;
+  } _cluster;
+  /*
+   * Positions of the stuck ions in sticking order. Chunks never move, so
+   * other threads may read the entries below the published count.
+   */
+  struct {
+    int enabled;
+    uint64_t count;
+    Point *chunks[ION_LOG_CHUNKS];
+  } _log;
+  /* Discs of the off-lattice model, hashed by the square holding their centre. */
+  struct {
+    double *x;
+    double *y;
+    uint32_t *next;     /* next disc in the same bucket */
+    uint32_t *head;     /* first disc of every bucket */
+    uint32_t mask;      /* buckets - 1 */
+    uint64_t n;
+    uint64_t capacity;
+    double r_max;       /* farthest centre from the seed */
+    double sum_x;       /* sums over the centres, for the cluster stats */
+    double sum_y;
+    double sum_r2;
+    double walk_x;      /* walker interrupted by a limit, with _walking */
+    double walk_y;
+  } _off;
+  /* Parameters of the growth rule. */
+  double _stick_p;
+  unsigned _hits;
+  /* Hits of every site under CRYSTAL_RULE_NOISE, perimeter marks under Eden. */
+  Matrix *_sites;
+  /* Perimeter of the Eden cluster: empty sites next to it, in no order. */
+  struct {
+    Point *sites;
+    uint64_t n;
+    uint64_t capacity;
+  } _eden;
+  /* Launch sites of the integer kernel by the leading bits of the draw. */
+  struct {
+    Point *sites;
+    unsigned bits;
+    unsigned r;         /* launch radius the entries belong to */
+  } _launch;
+};
+
+static Point const crystal_dp[] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+
+static inline void
+crystal_step_once(CrystalWalker *w,
+		  Point *p)
+{
+  Point const *d;
+  if (w->n_dirs == 0) {
+    w->dirs = cs_rand(&w->rng);
+    w->n_dirs = 32;
+  }
+  d = &crystal_dp[w->dirs & 3];
+  w->dirs >>= 2;
+  w->n_dirs--;
+  w->steps++;
+  p->x += d->x;
+  p->y += d->y;
+}
+
+/* Whether the distance of `p` from the seed, rounded down, is at least `r`. */
+static inline int
+crystal_outside_circle(unsigned r,
+		       Point const *p)
+{
+  return (uint64_t)((int64_t)p->x*p->x + (int64_t)p->y*p->y) >= (uint64_t)r*r;
+}
+
+/* Position of site (x, y) in the plane, rows 1 apart. */
+static inline void
+crystal_site_position(CrystalLattice lattice,
+		      int x,
+		      int y,
+		      double *px,
+		      double *py)
+{
+  if (lattice == CRYSTAL_LATTICE_HEX) {
+    *px = (x + 0.5 * (y & 1)) * CRYSTAL_HEX_WIDTH;
+  } else {
+    *px = x;
+  }
+  *py = y;
+}
+
+/* The site whose cell, a brick of its row on HEX, holds (px, py). */
+static inline Point
+crystal_site_at(CrystalLattice lattice,
+		double px,
+		double py)
+{
+  Point p;
+  p.y = (int)floor(py + 0.5);
+  if (lattice == CRYSTAL_LATTICE_HEX) {
+    p.x = (int)floor(px / CRYSTAL_HEX_WIDTH - 0.5 * (p.y & 1) + 0.5);
+  } else {
+    p.x = (int)floor(px + 0.5);
+  }
+  return p;
+}
+
+/* Distance of site `p` from the seed. */
+static inline double
+crystal_site_radius(CrystalLattice lattice,
+		    Point const *p)
+{
+  double px, py;
+  crystal_site_position(lattice, p->x, p->y, &px, &py);
+  return sqrt(px*px + py*py);
+}
+
+/* Whether the last ion reached the start radius, which ends the growth. */
+static inline int
+crystal_finished(CrystalModel const *self)
+{
+  if (self->_lattice == CRYSTAL_LATTICE_HEX) {
+    return (unsigned)crystal_site_radius(self->_lattice, &self->_p) >= self->_r_start;
+  }
+  return crystal_outside_circle(self->_r_start, &self->_p);
+}
+
+/*
+ * Whether the running CrystalModel_run_budget call has to return, once
+ * the model has walked `steps` steps. Cheap enough for every
+ * CRYSTAL_CHECK_STEPS steps, never true outside such a call.
+ */
+static inline int
+crystal_limit_reached(CrystalModel const *self,
+		      uint64_t steps)
+{
+  CrystalLimit *l = self->_limit;
+  int reached;
+
+  if (!l) {
+    return 0;
+  }
+  reached = (__atomic_load_n(&l->reached, __ATOMIC_RELAXED) ||
+	     steps >= l->end_steps ||
+	     (l->cancel && __atomic_load_n(l->cancel, __ATOMIC_RELAXED)) ||
+	     (l->deadline > 0 && crystal_time() >= l->deadline));
+  if (reached) {
+    __atomic_store_n(&l->reached, 1, __ATOMIC_RELAXED);
+  }
+  return reached;
+}
+
+#ifdef CRYSTAL_STATS
+/* Records one ion that stuck at `p`. */
+static inline void
+crystal_stats_record(CrystalStats *st,
+		     uint64_t steps,
+		     uint64_t relaunches,
+		     uint64_t checks,
+		     Point const *p,
+		     double seconds)
+{
+  unsigned const r = (unsigned)sqrt((double)p->x*p->x + (double)p->y*p->y);
+  unsigned const sb = 63 - __builtin_clzll(steps + 1);
+  unsigned const rb = r / st->radius_bin;
+
+  st->ions++;
+  st->steps += steps;
+  st->relaunches += relaunches;
+  st->neighbour_checks += checks;
+  st->seconds += seconds;
+  st->steps_hist[sb < CRYSTAL_STATS_BINS ? sb : CRYSTAL_STATS_BINS - 1]++;
+  st->radius_hist[rb < CRYSTAL_STATS_BINS ? rb : CRYSTAL_STATS_BINS - 1]++;
+}
+#endif
+
+/*
+ * Prepares `w` for ion number `ion`. Every ion walks on its own random
+ * stream so that ions can be walked out of order by other threads.
+ */
+extern void
+crystal_begin_ion(CrystalModel const *self,
+		  CrystalWalker *w,
+		  uint64_t ion);
+extern void
+crystal_drop_new_ion(CrystalWalker *w,
+		     Point *p);
+/*
+ * The site on the circle of radius `r` that crystal_drop_new_ion picks
+ * for the 53 random bits `u`.
+ */
+extern void
+crystal_launch_point(unsigned r,
+		     uint64_t u,
+		     Point *p);
+extern void
+crystal_escape(CrystalModel const *self,
+	       CrystalWalker *w,
+	       Point *p);
+extern int
+crystal_any_neighbours(CrystalModel const *self,
+		       Point const *p);
+
+/* crystal_any_neighbours, counted in the statistics of `w`. */
+static inline int
+crystal_walker_sticks(CrystalModel const *self,
+		      CrystalWalker *w,
+		      Point const *p)
+{
+  CRYSTAL_STAT(w->checks++);
+  (void)w;
+  return crystal_any_neighbours(self, p);
+}
+
+extern void
+crystal_stick_ion(CrystalModel *self,
+		  int x,
+		  int y);
+/* Appends (x, y) to the ion log, whether enabled or not. */
+extern void
+crystal_log_ion(CrystalModel *self,
+		int x,
+		int y);
+
+extern int
+crystal_batch_crystallize_one_ion(CrystalModel *self);
+/* Whether the integer kernel can index the cells of `mat` linearly. */
+static inline int
+crystal_integer_bath(Matrix const *mat)
+{
+  return Matrix_layout(mat) == MATRIX_LAYOUT_BYTES || Matrix_has_halo(mat);
+}
+extern int
+crystal_integer_crystallize_one_ion(CrystalModel *self);
+
+/* Forgets every disc but the seed. */
+extern void
+crystal_off_reset(CrystalModel *self);
+extern void
+crystal_off_free(CrystalModel *self);
+extern int
+crystal_off_crystallize_one_ion(CrystalModel *self);
+
+extern int
+crystal_eden_crystallize_one_ion(CrystalModel *self);
+/* Adds the empty neighbours of the new cell (x, y) to the perimeter. */
+extern void
+crystal_eden_add_perimeter(CrystalModel *self,
+			   int x,
+			   int y);
+
+#endif /* CRYSTAL_MODEL_PRIVATE_H_ */
@@ -0,0 +1,356 @@
+#include "CrystalModelPrivate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Off-lattice growth. Discs of unit diameter sit at continuous positions
+ * and a walker sticks where it first touches one. Stuck discs are hashed
+ * by the CELL x CELL square holding their centre, so contact and
+ * nearest-disc queries read a few buckets whatever the crystal size.
+ * A walker jumps to a uniform point on the largest circle around it that
+ * is known to miss the crystal: far away the circle clears the disc
+ * holding every centre, nearer it clears the cells of the bath within
+ * the proximity map of the lattice model, and close by the nearest disc.
+ * Only closer than STEP to the crystal does it take steps of length
+ * STEP, stopping at the first contact along each one.
+ */
+
+/* Side of the hashed squares, at least STEP plus one diameter. */
+#define CELL 2.0
+#define STEP 0.5
+/* Rings of squares searched for the nearest disc. */
+#define NEAR_RINGS 2
+/* A centre and a walker lie up to half a diagonal from their cells. */
+#define CELL_SLACK M_SQRT2
+#define MIN_BUCKETS 1024
+#define NO_DISC UINT32_MAX
+/* Rounding error allowed on the distance of touching discs. */
+#define TOUCH_EPSILON 1e-9
+
+static void
+launch(CrystalWalker *w,
+       double *x,
+       double *y);
+static void
+move(CrystalWalker *w,
+     double *x,
+     double *y,
+     double r);
+static double
+proximity(CrystalModel const *self,
+	  double x,
+	  double y,
+	  double rho);
+static double
+nearest(CrystalModel const *self,
+	double x,
+	double y);
+static double
+contact(CrystalModel const *self,
+	double x,
+	double y,
+	double ux,
+	double uy);
+static void
+add_disc(CrystalModel *self,
+	 double x,
+	 double y);
+static void
+rehash(CrystalModel *self,
+       uint32_t buckets);
+static uint32_t
+bucket_of(CrystalModel const *self,
+	  int64_t cx,
+	  int64_t cy);
+
+extern int
+crystal_off_crystallize_one_ion(CrystalModel *self)
+{
+  CrystalWalker *w = &self->_walker;
+  double x, y, rho, d, alpha, t;
+  uint64_t check;
+  Point p;
+  CRYSTAL_STAT(double const t0 = crystal_time());
+
+  if (self->_walking) {
+    x = self->_off.walk_x;
+    y = self->_off.walk_y;
+    self->_walking = 0;
+  } else {
+    crystal_begin_ion(self, w, self->_ions);
+    launch(w, &x, &y);
+  }
+  check = self->_limit ? w->steps + CRYSTAL_CHECK_STEPS : UINT64_MAX;
+  for (;;) {
+    if (w->steps >= check) {
+      if (crystal_limit_reached(self, self->_steps + w->steps)) {
+	CRYSTAL_STAT(w->seconds += crystal_time() - t0);
+	self->_off.walk_x = x;
+	self->_off.walk_y = y;
+	self->_walking = 1;
+	return 1;
+      }
+      check += CRYSTAL_CHECK_STEPS;
+    }
+    rho = sqrt(x*x + y*y);
+    if (rho >= w->r_kill) {
+      launch(w, &x, &y);
+      w->escapes++;
+      continue;
+    }
+    w->steps++;
+    d = proximity(self, x, y, rho);
+    if (d < NEAR_RINGS * CELL) {
+      double const dn = nearest(self, x, y) - 1;
+      d = dn > d ? dn : d;
+      if (d < -TOUCH_EPSILON) {
+	/* Launched into the crystal once it reached the launch circle. */
+	launch(w, &x, &y);
+	w->escapes++;
+	continue;
+      }
+    }
+    if (d > STEP) {
+      move(w, &x, &y, d);
+      continue;
+    }
+    alpha = 2 * M_PI * cs_drand(&w->rng);
+    CRYSTAL_STAT(w->checks++);
+    t = contact(self, x, y, cos(alpha), sin(alpha));
+    if (t <= STEP) {
+      x += t * cos(alpha);
+      y += t * sin(alpha);
+      break;
+    }
+    x += STEP * cos(alpha);
+    y += STEP * sin(alpha);
+  }
+  self->_steps += w->steps;
+  self->_escapes += w->escapes;
+  add_disc(self, x, y);
+  p.x = (int)lround(x);
+  p.y = (int)lround(y);
+  self->_p = p;
+  crystal_stick_ion(self, p.x, p.y);
+  CRYSTAL_STAT(crystal_stats_record(&self->_stats, w->steps, w->escapes, w->checks, &p,
+				    w->seconds + crystal_time() - t0));
+  return !crystal_outside_circle(self->_r_start, &self->_p);
+}
+
+extern void
+crystal_off_reset(CrystalModel *self)
+{
+  if (!self->_off.head) {
+    rehash(self, MIN_BUCKETS);
+  }
+  for (uint32_t b = 0; b <= self->_off.mask; ++b) {
+    self->_off.head[b] = NO_DISC;
+  }
+  self->_off.n = 0;
+  self->_off.r_max = 0;
+  self->_off.sum_x = 0;
+  self->_off.sum_y = 0;
+  self->_off.sum_r2 = 0;
+  add_disc(self, 0, 0);
+}
+
+extern void
+crystal_off_free(CrystalModel *self)
+{
+  free(self->_off.x);
+  free(self->_off.y);
+  free(self->_off.next);
+  free(self->_off.head);
+  memset(&self->_off, 0, sizeof(self->_off));
+}
+
+extern uint64_t
+CrystalModel_get_discs(CrystalModel const *self)
+{
+  return self->_lattice == CRYSTAL_LATTICE_OFF ? self->_off.n : 0;
+}
+
+extern void
+CrystalModel_get_disc(CrystalModel const *self,
+		      uint64_t i,
+		      double *x,
+		      double *y)
+{
+  *x = self->_off.x[i];
+  *y = self->_off.y[i];
+}
+
+static void
+launch(CrystalWalker *w,
+       double *x,
+       double *y)
+{
+  double const alpha = 2 * M_PI * cs_drand(&w->rng);
+  *x = w->r_launch * cos(alpha);
+  *y = w->r_launch * sin(alpha);
+}
+
+/* Uniform point on the circle of radius `r` around the walker. */
+static void
+move(CrystalWalker *w,
+     double *x,
+     double *y,
+     double r)
+{
+  double const alpha = 2 * M_PI * cs_drand(&w->rng);
+  *x += r * cos(alpha);
+  *y += r * sin(alpha);
+}
+
+/*
+ * Lower bound of the distance the walker at (x, y), `rho` from the seed,
+ * can travel before it touches the crystal.
+ */
+static double
+proximity(CrystalModel const *self,
+	  double x,
+	  double y,
+	  double rho)
+{
+  double const d = rho - self->_off.r_max - 1;
+  int p;
+
+  if (rho >= self->_r_max + DIST_CAP) {
+    return d;
+  }
+  p = Matrix_get(self->_prox,
+		 CrystalModel_x_bath_to_model_rep(self, (int)lround(x)),
+		 CrystalModel_y_bath_to_model_rep(self, (int)lround(y)));
+  if (p == 0) {
+    /* No cell within DIST_CAP. */
+    return d > DIST_CAP - CELL_SLACK - 1 ? d : DIST_CAP - CELL_SLACK - 1;
+  }
+  return d > DIST_CAP - p - CELL_SLACK - 1 ? d : DIST_CAP - p - CELL_SLACK - 1;
+}
+
+/*
+ * Distance from (x, y) to the nearest centre, or NEAR_RINGS * CELL if
+ * that is closer. Squares k rings away lie at least (k - 1) * CELL away.
+ */
+static double
+nearest(CrystalModel const *self,
+	double x,
+	double y)
+{
+  int64_t const cx = (int64_t)floor(x / CELL), cy = (int64_t)floor(y / CELL);
+  double best2 = (NEAR_RINGS * CELL) * (NEAR_RINGS * CELL);
+
+  for (int k = 0; k <= NEAR_RINGS && (k == 0 || best2 > ((k - 1) * CELL) * ((k - 1) * CELL)); ++k) {
+    for (int64_t j = cy - k; j <= cy + k; ++j) {
+      /* Only the squares on the border of ring k. */
+      int64_t const step = (j == cy - k || j == cy + k) ? 1 : 2*k;
+      for (int64_t i = cx - k; i <= cx + k; i += step) {
+	for (uint32_t n = self->_off.head[bucket_of(self, i, j)]; n != NO_DISC;
+	     n = self->_off.next[n]) {
+	  double const dx = x - self->_off.x[n], dy = y - self->_off.y[n];
+	  double const d2 = dx*dx + dy*dy;
+	  best2 = d2 < best2 ? d2 : best2;
+	}
+      }
+    }
+  }
+  return sqrt(best2);
+}
+
+/*
+ * Length along the unit direction (ux, uy) after which the walker
+ * touches a disc, larger than STEP if it does not within STEP.
+ */
+static double
+contact(CrystalModel const *self,
+	double x,
+	double y,
+	double ux,
+	double uy)
+{
+  int64_t const cx = (int64_t)floor(x / CELL), cy = (int64_t)floor(y / CELL);
+  double best = 2 * STEP;
+
+  for (int64_t j = cy - 1; j <= cy + 1; ++j) {
+    for (int64_t i = cx - 1; i <= cx + 1; ++i) {
+      for (uint32_t n = self->_off.head[bucket_of(self, i, j)]; n != NO_DISC;
+	   n = self->_off.next[n]) {
+	/* |p + t u - q| = 1, the smaller root */
+	double const dx = x - self->_off.x[n], dy = y - self->_off.y[n];
+	double const b = ux*dx + uy*dy;
+	double const c = dx*dx + dy*dy - 1;
+	double const disc = b*b - c;
+	double t;
+	if (disc < 0 || b >= 0) {
+	  continue;
+	}
+	t = c > 0 ? -b - sqrt(disc) : 0;
+	best = t < best ? t : best;
+      }
+    }
+  }
+  return best;
+}
+
+static void
+add_disc(CrystalModel *self,
+	 double x,
+	 double y)
+{
+  uint64_t const n = self->_off.n;
+  uint32_t b;
+  double const r = sqrt(x*x + y*y);
+  unsigned const m = (unsigned)ceil(r);
+
+  if (n == self->_off.capacity) {
+    self->_off.capacity = n ? 2*n : MIN_BUCKETS;
+    self->_off.x = (double *)realloc(self->_off.x, self->_off.capacity * sizeof(double));
+    self->_off.y = (double *)realloc(self->_off.y, self->_off.capacity * sizeof(double));
+    self->_off.next = (uint32_t *)realloc(self->_off.next, self->_off.capacity * sizeof(uint32_t));
+  }
+  self->_off.x[n] = x;
+  self->_off.y[n] = y;
+  self->_off.n = n + 1;
+  b = bucket_of(self, (int64_t)floor(x / CELL), (int64_t)floor(y / CELL));
+  self->_off.next[n] = self->_off.head[b];
+  self->_off.head[b] = (uint32_t)n;
+  self->_off.r_max = r > self->_off.r_max ? r : self->_off.r_max;
+  /* Every disc counts at its centre, also where two round to one cell of the bath. */
+  self->_off.sum_x += x;
+  self->_off.sum_y += y;
+  self->_off.sum_r2 += x*x + y*y;
+  self->_cluster.n++;
+  self->_cluster.mass[m < self->_cluster.mass_size ? m : self->_cluster.mass_size - 1]++;
+  if (self->_off.n > self->_off.mask) {
+    rehash(self, 2 * (self->_off.mask + 1));
+  }
+}
+
+/* Keeps about one disc per bucket as the crystal grows. */
+static void
+rehash(CrystalModel *self,
+       uint32_t buckets)
+{
+  free(self->_off.head);
+  self->_off.head = (uint32_t *)malloc(buckets * sizeof(uint32_t));
+  self->_off.mask = buckets - 1;
+  for (uint32_t b = 0; b < buckets; ++b) {
+    self->_off.head[b] = NO_DISC;
+  }
+  for (uint64_t n = 0; n < self->_off.n; ++n) {
+    uint32_t const b = bucket_of(self, (int64_t)floor(self->_off.x[n] / CELL),
+				 (int64_t)floor(self->_off.y[n] / CELL));
+    self->_off.next[n] = self->_off.head[b];
+    self->_off.head[b] = (uint32_t)n;
+  }
+}
+
+static uint32_t
+bucket_of(CrystalModel const *self,
+	  int64_t cx,
+	  int64_t cy)
+{
+  uint64_t const h = (uint64_t)cx * UINT64_C(0x9E3779B97F4A7C15) ^ (uint64_t)cy * UINT64_C(0xC2B2AE3D27D4EB4F);
+  return (uint32_t)(h >> 32 ^ h) & self->_off.mask;
+}
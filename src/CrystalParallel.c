@@ -0,0 +1,315 @@
+#include "CrystalModelPrivate.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+/*
+ * Speculative parallel growth. Worker threads claim ion numbers in order
+ * and walk them against the live bath before the previous ions have
+ * stuck. Every ion walks on its own random stream (crystal_begin_ion), so
+ * its walk only depends on the cells it looked at. Ions commit strictly
+ * in sequence, and a walk is redone if one of the ions committed since
+ * it started landed next to a cell it visited, or if the adaptive radii
+ * changed meanwhile. The result is identical to the serial kernel.
+ *
+ * Walkers read the bath while the committing thread writes it, so they
+ * read through Matrix_get_shared; the conflict check only has to catch
+ * values that are stale, never torn ones.
+ *
+ * Within CrystalModel_run_budget the walkers stop at a limit. The walk of
+ * the next ion to commit is kept for the serial kernel to continue, as
+ * long as no ion committed meanwhile touched it; later walks are dropped.
+ */
+
+/*
+ * Visited cells are recorded per block of 2^block_shift x 2^block_shift,
+ * starting at MIN_BLOCK_SHIFT and coarser on baths that would need more
+ * than MAX_BLOCKS_PER_ROW blocks per row.
+ */
+#define MIN_BLOCK_SHIFT 3
+#define MAX_BLOCKS_PER_ROW 2048
+
+typedef struct
+{
+  CrystalModel *cm;
+  pthread_mutex_t lock;
+  pthread_cond_t committed;
+  uint64_t next_ion;
+  uint64_t end_ion;
+  int done;
+  int stopped;        /* a limit of CrystalModel_run_budget was reached */
+  Point *log;         /* committed ions, indexed by ion & log_mask */
+  uint64_t log_mask;
+  unsigned block_shift;
+  unsigned blocks_per_row;
+} ParallelRun;
+
+typedef struct
+{
+  ParallelRun *run;
+  uint32_t *stamps;   /* last ion that visited each block */
+  pthread_t thread;
+#ifdef CRYSTAL_STATS
+  CrystalStats stats; /* merged into the model's after the run */
+#endif
+} ParallelWorker;
+
+static void *
+worker_main(void *arg);
+static int
+walk(CrystalModel const *cm,
+     CrystalWalker *w,
+     Point *p,
+     ParallelWorker *wk,
+     uint32_t stamp);
+static int
+sticks(CrystalModel const *cm,
+       CrystalWalker *w,
+       Point const *p);
+static void
+keep_walk(CrystalModel *cm,
+	  CrystalWalker const *w,
+	  Point const *p);
+static int
+conflicts(ParallelWorker const *wk,
+	  CrystalWalker const *w,
+	  uint64_t first_unseen,
+	  uint64_t ion);
+static size_t
+block_of(ParallelRun const *run,
+	 int x,
+	 int y);
+
+extern int
+CrystalModel_run_parallel(CrystalModel *self,
+			  unsigned steps,
+			  unsigned threads)
+{
+  ParallelRun run;
+  ParallelWorker *workers;
+  size_t blocks;
+
+  if (threads <= 1 || self->_kernel == CRYSTAL_KERNEL_BATCH || self->_long_jumps ||
+      self->_lattice != CRYSTAL_LATTICE_SQUARE || self->_rule != CRYSTAL_RULE_DLA) {
+    return CrystalModel_run_some_steps(self, steps);
+  }
+  if (crystal_finished(self)) {
+    return 0;
+  }
+
+  run.cm = self;
+  pthread_mutex_init(&run.lock, NULL);
+  pthread_cond_init(&run.committed, NULL);
+  run.next_ion = self->_ions;
+  run.end_ion = self->_ions + steps;
+  run.done = 0;
+  run.stopped = 0;
+  if (self->_walking) {
+    /* An interrupted walk is finished first, it may be interrupted again. */
+    if (!CrystalModel_crystallize_one_ion(self)) {
+      return 0;
+    }
+    if (self->_walking || crystal_limit_reached(self, self->_steps) || --steps == 0) {
+      return 1;
+    }
+    run.next_ion = self->_ions;
+    run.end_ion = self->_ions + steps;
+  }
+  for (run.log_mask = 1; run.log_mask < 2*threads; run.log_mask <<= 1) {
+  }
+  run.log = (Point *)calloc(run.log_mask, sizeof(Point));
+  run.log_mask--;
+  for (run.block_shift = MIN_BLOCK_SHIFT;
+       (Matrix_size(self->_mat) >> run.block_shift) >= MAX_BLOCKS_PER_ROW;
+       run.block_shift++) {
+  }
+  run.blocks_per_row = (Matrix_size(self->_mat) >> run.block_shift) + 1;
+  blocks = (size_t)run.blocks_per_row * run.blocks_per_row;
+
+  workers = (ParallelWorker *)calloc(threads, sizeof(ParallelWorker));
+  for (unsigned i = 0; i < threads; ++i) {
+    workers[i].run = &run;
+    workers[i].stamps = (uint32_t *)calloc(blocks, sizeof(uint32_t));
+    CRYSTAL_STAT(workers[i].stats.radius_bin = self->_stats.radius_bin);
+    pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+  }
+  for (unsigned i = 0; i < threads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    CRYSTAL_STAT(CrystalStats_add(&self->_stats, &workers[i].stats));
+    free(workers[i].stamps);
+  }
+  free(workers);
+  free(run.log);
+  pthread_cond_destroy(&run.committed);
+  pthread_mutex_destroy(&run.lock);
+  return !run.done;
+}
+
+static void *
+worker_main(void *arg)
+{
+  ParallelWorker *wk = (ParallelWorker *)arg;
+  ParallelRun *run = wk->run;
+  CrystalModel *cm = run->cm;
+  CrystalWalker w;
+  Point p;
+  uint64_t ion, first_unseen;
+  int stuck = 1;
+
+  pthread_mutex_lock(&run->lock);
+  while (!run->done && !run->stopped && run->next_ion < run->end_ion) {
+    ion = run->next_ion++;
+    first_unseen = cm->_ions;
+    crystal_begin_ion(cm, &w, ion);
+    pthread_mutex_unlock(&run->lock);
+
+    /* Only walking is timed, not waiting for the ions before. */
+    CRYSTAL_STAT(double seconds = crystal_time());
+    stuck = walk(cm, &w, &p, wk, (uint32_t)ion + 1);
+    CRYSTAL_STAT(seconds = crystal_time() - seconds);
+
+    pthread_mutex_lock(&run->lock);
+    if (!stuck && !run->done && cm->_ions == ion && !conflicts(wk, &w, first_unseen, ion)) {
+      CRYSTAL_STAT(w.seconds = seconds);
+      keep_walk(cm, &w, &p);
+    }
+    while (stuck && !run->done && !run->stopped && cm->_ions < ion) {
+      pthread_cond_wait(&run->committed, &run->lock);
+    }
+    if (!stuck || run->done || run->stopped) {
+      break;
+    }
+    if (conflicts(wk, &w, first_unseen, ion)) {
+      /* Every earlier ion has stuck and nobody else commits before this
+	 one, so walking again gives the serial result. */
+      pthread_mutex_unlock(&run->lock);
+      CRYSTAL_STAT(seconds -= crystal_time());
+      crystal_begin_ion(cm, &w, ion);
+      stuck = walk(cm, &w, &p, NULL, 0);
+      CRYSTAL_STAT(seconds += crystal_time());
+      pthread_mutex_lock(&run->lock);
+      if (!stuck) {
+	CRYSTAL_STAT(w.seconds = seconds);
+	keep_walk(cm, &w, &p);
+	break;
+      }
+      cm->_retries++;
+    }
+    cm->_steps += w.steps;
+    cm->_escapes += w.escapes;
+    cm->_p = p;
+    crystal_stick_ion(cm, p.x, p.y);
+    run->log[ion & run->log_mask] = p;
+    CRYSTAL_STAT(crystal_stats_record(&wk->stats, w.steps, w.escapes, w.checks, &p, seconds));
+    if (crystal_outside_circle(cm->_r_start, &p)) {
+      run->done = 1;
+    } else if (crystal_limit_reached(cm, cm->_steps)) {
+      run->stopped = 1;
+    }
+    pthread_cond_broadcast(&run->committed);
+  }
+  if (!stuck) {
+    run->stopped = 1;
+    pthread_cond_broadcast(&run->committed);
+  }
+  pthread_mutex_unlock(&run->lock);
+  return NULL;
+}
+
+/*
+ * Same walk as the serial kernel, recording visited blocks in `wk`.
+ * Returns 0 if a limit ended the walk before the ion stuck.
+ */
+static int
+walk(CrystalModel const *cm,
+     CrystalWalker *w,
+     Point *p,
+     ParallelWorker *wk,
+     uint32_t stamp)
+{
+  uint64_t check = cm->_limit ? CRYSTAL_CHECK_STEPS : UINT64_MAX;
+
+  crystal_drop_new_ion(w, p);
+  for (;;) {
+    if (wk) {
+      wk->stamps[block_of(wk->run, p->x, p->y)] = stamp;
+    }
+    if (sticks(cm, w, p)) {
+      return 1;
+    }
+    if (crystal_outside_circle(w->r_kill, p)) {
+      crystal_escape(cm, w, p);
+      w->escapes++;
+    }
+    crystal_step_once(w, p);
+    if (w->steps >= check) {
+      /* Other threads commit steps, only time and cancellation count here. */
+      if (crystal_limit_reached(cm, 0)) {
+	return 0;
+      }
+      check += CRYSTAL_CHECK_STEPS;
+    }
+  }
+}
+
+/* crystal_walker_sticks on a bath that another thread may be writing. */
+static int
+sticks(CrystalModel const *cm,
+       CrystalWalker *w,
+       Point const *p)
+{
+  Matrix const *mat = cm->_mat;
+  unsigned const x = CrystalModel_x_bath_to_model_rep(cm, p->x);
+  unsigned const y = CrystalModel_y_bath_to_model_rep(cm, p->y);
+
+  CRYSTAL_STAT(w->checks++);
+  (void)w;
+  if (Matrix_has_halo(mat)) {
+    return Matrix_get_halo_shared(mat, x, y);
+  }
+  return (Matrix_get_shared(mat, x + 1, y) || Matrix_get_shared(mat, x - 1, y) ||
+	  Matrix_get_shared(mat, x, y - 1) || Matrix_get_shared(mat, x, y + 1));
+}
+
+/* Hands a walk of the next ion to CrystalModel_crystallize_one_ion. */
+static void
+keep_walk(CrystalModel *cm,
+	  CrystalWalker const *w,
+	  Point const *p)
+{
+  cm->_walker = *w;
+  cm->_walk_p = *p;
+  cm->_walking = 1;
+}
+
+static int
+conflicts(ParallelWorker const *wk,
+	  CrystalWalker const *w,
+	  uint64_t first_unseen,
+	  uint64_t ion)
+{
+  ParallelRun const *run = wk->run;
+  uint32_t const stamp = (uint32_t)ion + 1;
+
+  if (w->r_launch != run->cm->_r_launch || w->r_kill != run->cm->_r_kill) {
+    return 1;
+  }
+  for (uint64_t j = first_unseen; j < ion; ++j) {
+    Point const *q = &run->log[j & run->log_mask];
+    for (int k = 0; k < 4; ++k) {
+      if (wk->stamps[block_of(run, q->x + crystal_dp[k].x, q->y + crystal_dp[k].y)] == stamp) {
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static size_t
+block_of(ParallelRun const *run,
+	 int x,
+	 int y)
+{
+  return (CrystalModel_x_bath_to_model_rep(run->cm, x) >> run->block_shift) +
+    (size_t)(CrystalModel_y_bath_to_model_rep(run->cm, y) >> run->block_shift) * run->blocks_per_row;
+}
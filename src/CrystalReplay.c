@@ -0,0 +1,67 @@
+#include "CrystalReplay.h"
+
+#include <stdlib.h>
+
+struct crystal_replay_t
+{
+  uint64_t _ions;
+  int _r;             /* the square is [-_r, _r]^2 */
+  unsigned _side;
+  uint32_t *_arrival; /* row-major, top row first */
+};
+
+extern CrystalReplay *
+CrystalReplay_create(CrystalModel const *cm)
+{
+  CrystalReplay *self;
+  uint64_t n;
+  int r = 0;
+
+  if (!CrystalModel_get_ion_log(cm)) {
+    return NULL;
+  }
+  n = CrystalModel_get_logged_ions(cm);
+  n = n < UINT32_MAX ? n : UINT32_MAX;
+  for (uint64_t i = 0; i < n; ++i) {
+    Point const p = CrystalModel_get_logged_ion(cm, i);
+    int const d = abs(p.x) > abs(p.y) ? abs(p.x) : abs(p.y);
+    r = d > r ? d : r;
+  }
+
+  self = (CrystalReplay *)calloc(1, sizeof(CrystalReplay));
+  self->_ions = n;
+  self->_r = r;
+  self->_side = 2*r + 1;
+  self->_arrival = (uint32_t *)calloc((size_t)self->_side * self->_side, sizeof(uint32_t));
+  for (uint64_t i = 0; i < n; ++i) {
+    Point const p = CrystalModel_get_logged_ion(cm, i);
+    self->_arrival[(size_t)(r - p.y) * self->_side + (p.x + r)] = (uint32_t)i + 1;
+  }
+  return self;
+}
+
+extern void
+CrystalReplay_destroy(CrystalReplay *self)
+{
+  if (!self) { return; }
+
+  free(self->_arrival);
+  free(self);
+}
+
+extern uint64_t
+CrystalReplay_get_ions(CrystalReplay const *self)
+{
+  return self->_ions;
+}
+
+extern uint32_t
+CrystalReplay_get_arrival(CrystalReplay const *self,
+			  int x,
+			  int y)
+{
+  if (x < -self->_r || x > self->_r || y < -self->_r || y > self->_r) {
+    return 0;
+  }
+  return self->_arrival[(size_t)(self->_r - y) * self->_side + (x + self->_r)];
+}
@@ -0,0 +1,37 @@
+#ifndef CRYSTALREPLAY_H_
+#define CRYSTALREPLAY_H_
+
+#include <inttypes.h>
+
+#include "CrystalModel.h"
+
+/*
+ * Arrival index of every cell of a crystal, built from its ion log, so
+ * the crystal as it was after any number of ions can be drawn without
+ * growing it again. Covers the square around the seed that holds the
+ * crystal, 4 bytes per cell.
+ */
+typedef struct crystal_replay_t CrystalReplay;
+
+/*
+ * Indexes the ions logged so far, at most UINT32_MAX of them; NULL
+ * unless the ion log of `cm` is enabled.
+ */
+extern CrystalReplay *
+CrystalReplay_create(CrystalModel const *cm);
+extern void
+CrystalReplay_destroy(CrystalReplay *self);
+/* Number of ions indexed. */
+extern uint64_t
+CrystalReplay_get_ions(CrystalReplay const *self);
+/*
+ * Arrival index of the ion at (x, y), in bath coordinates: 1 for the
+ * first ion up to CrystalReplay_get_ions for the last one, 0 for cells
+ * that stayed empty.
+ */
+extern uint32_t
+CrystalReplay_get_arrival(CrystalReplay const *self,
+			  int x,
+			  int y);
+
+#endif //CRYSTALREPLAY_H_
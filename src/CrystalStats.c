@@ -0,0 +1,81 @@
+#include "CrystalStats.h"
+
+/* Width of the longest histogram bar. */
+#define BAR_WIDTH 40
+
+static void
+print_histogram(uint64_t const *hist,
+		char const *title,
+		unsigned bin,
+		int log_bins,
+		FILE *out);
+
+extern void
+CrystalStats_add(CrystalStats *self,
+		 CrystalStats const *other)
+{
+  self->ions += other->ions;
+  self->steps += other->steps;
+  self->relaunches += other->relaunches;
+  self->neighbour_checks += other->neighbour_checks;
+  self->seconds += other->seconds;
+  for (int i = 0; i < CRYSTAL_STATS_BINS; ++i) {
+    self->steps_hist[i] += other->steps_hist[i];
+    self->radius_hist[i] += other->radius_hist[i];
+  }
+}
+
+extern void
+CrystalStats_print(CrystalStats const *self,
+		   FILE *out)
+{
+  double const ions = self->ions ? self->ions : 1;
+
+  fprintf(out, "ions %" PRIu64 ", steps %" PRIu64 ", relaunches %" PRIu64
+	  ", neighbour checks %" PRIu64 ", %.3f s\n",
+	  self->ions, self->steps, self->relaunches, self->neighbour_checks, self->seconds);
+  fprintf(out, "per ion: %.1f steps, %.3f relaunches, %.1f neighbour checks, %.2f us\n",
+	  self->steps / ions, self->relaunches / ions, self->neighbour_checks / ions,
+	  self->seconds * 1e6 / ions);
+  print_histogram(self->steps_hist, "steps to stick", 1, 1, out);
+  print_histogram(self->radius_hist, "sticking radius", self->radius_bin, 0, out);
+}
+
+extern void
+CrystalStats_summary(CrystalStats const *self,
+		     char *buf,
+		     size_t size)
+{
+  double const ions = self->ions ? self->ions : 1;
+
+  snprintf(buf, size, "%" PRIu64 " ions  %.0f steps/ion  %.2f relaunches/ion  %.1f us/ion",
+	   self->ions, self->steps / ions, self->relaunches / ions,
+	   self->seconds * 1e6 / ions);
+}
+
+static void
+print_histogram(uint64_t const *hist,
+		char const *title,
+		unsigned bin,
+		int log_bins,
+		FILE *out)
+{
+  uint64_t max = 0;
+  int last = -1;
+
+  for (int i = 0; i < CRYSTAL_STATS_BINS; ++i) {
+    if (hist[i]) {
+      last = i;
+      max = hist[i] > max ? hist[i] : max;
+    }
+  }
+  fprintf(out, "%s:\n", title);
+  for (int i = 0; i <= last; ++i) {
+    uint64_t const lo = log_bins ? (UINT64_C(1) << i) - 1 : (uint64_t)i * bin;
+    fprintf(out, "  >= %10" PRIu64 " %10" PRIu64 " ", lo, hist[i]);
+    for (uint64_t k = 0; k < hist[i] * BAR_WIDTH / max; ++k) {
+      putc('#', out);
+    }
+    putc('\n', out);
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef CRYSTALSTATS_H_
+#define CRYSTALSTATS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <time.h>
+
+/* Number of bins of each histogram. */
+#define CRYSTAL_STATS_BINS 32
+
+/* Seconds on the monotonic clock, for the timings of runs and walks. */
+static inline double
+crystal_time(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec/1e9;
+}
+
+/*
+ * Counters of the walker kernels, only gathered when built with
+ * CRYSTAL_STATS defined (the CRYSTAL_STATS CMake option).
+ */
+typedef struct
+{
+  int enabled;               /* 0 when built without CRYSTAL_STATS */
+  uint64_t ions;
+  uint64_t steps;
+  uint64_t relaunches;       /* kill circle crossings */
+  uint64_t neighbour_checks;
+  double seconds;            /* spent walking the ions, summed over threads */
+  /* Ions by floor(log2(steps to stick + 1)). */
+  uint64_t steps_hist[CRYSTAL_STATS_BINS];
+  /* Ions by sticking radius, in bins of radius_bin lattice units. */
+  unsigned radius_bin;
+  uint64_t radius_hist[CRYSTAL_STATS_BINS];
+} CrystalStats;
+
+extern void
+CrystalStats_add(CrystalStats *self,
+		 CrystalStats const *other);
+
+/* Writes the counters and both histograms, several lines. */
+extern void
+CrystalStats_print(CrystalStats const *self,
+		   FILE *out);
+
+/* Writes the per ion averages as one line into `buf`. */
+extern void
+CrystalStats_summary(CrystalStats const *self,
+		     char *buf,
+		     size_t size);
+
+#endif //CRYSTALSTATS_H_
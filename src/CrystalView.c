@@ -2,30 +2,127 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
 
+#include "DensityPyramid.h"
 #include "Point.h"
 
+/* Red channel of the CAIRO_FORMAT_RGB24 surface, showing the density. */
+#define DENSITY_SHIFT 16
+/* Height of the statistics lines over the crystal. */
+#define STATS_HEIGHT 36
+/* Repaints per second at most, whatever the refresh rate of the display. */
+#define MAX_FPS 30
+/* Zoom factor of a scroll wheel step, and the closest zoom in cells per pixel. */
+#define ZOOM_STEP 1.25
+#define MIN_ZOOM (1.0 / 32)
+/* Largest canvas asked for, larger baths start zoomed out. */
+#define MAX_REQUEST 800
+
+/*
+ * The widget shows the bath at _zoom cells per pixel, each pixel sampling
+ * the density pyramid at the level whose blocks are about a pixel wide,
+ * so drawing takes time in the widget size and not in the bath size.
+ * Pixel (px, py) shows the cell at _x0 + (_pan_x + px + 0.5) * _zoom
+ * across and likewise down, across counted in rows: the cells of a
+ * lattice with wider sites are drawn _site_width wide, with the shifted
+ * rows of CRYSTAL_LATTICE_HEX shifted on screen too. Panning only changes the whole pixel
+ * offsets, so the pixels scrolled along stay exact and only the exposed
+ * strips are sampled again.
+ *
+ * Every repaint adds the ions logged since the last one to the pyramid
+ * and samples again only the pixels over their blocks. Repaints follow
+ * the frame clock; the simulation thread never touches GTK, it only
+ * appends to the ion log and publishes the statistics text.
+ */
 struct crystal_view_t
 {
   CrystalModel *_cm;
+  DensityPyramid *_pyramid;
   cairo_surface_t *_surface;
   GtkWidget *_canvas;
 
-  cairo_t *_cr;
-  unsigned _width;
+  unsigned _width;    /* of the surface, in pixels */
   unsigned _height;
+  unsigned _bath_width;
+  double _site_width;
+
+  double _zoom;       /* bath cells per pixel */
+  double _x0;
+  double _y0;
+  long _pan_x;
+  long _pan_y;
+  unsigned _level;    /* pyramid level sampled */
+  double _density;    /* 1 over the cells of a block of _level */
+  int _fitted;        /* shows the whole bath, whatever the widget size */
+  double _drag_x;     /* pointer position at the last drag step */
+  double _drag_y;
+
+  uint64_t _drawn;    /* logged ions already in the pyramid */
+  Point _walker;      /* walker cell drawn by the last draw_cb */
+  gint64 _last_frame; /* frame clock time of the last repaint, in us */
 
-  int _scale_required;
-  double _x_scale;
-  double _y_scale;
+  pthread_mutex_t _stats_lock;
+  char _stats[2][128];
+  unsigned _stats_epoch;  /* bumped by every CrystalView_publish_stats */
+  unsigned _shown_epoch;
 };
 
+/* Pixels [x0, x1) x [y0, y1) of the widget. */
+typedef struct
+{
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+} PixelRect;
+
 static void
-draw_background(CrystalView *self);
+fit_view(CrystalView *self);
 static void
-draw_edge(CrystalView *self);
+set_zoom(CrystalView *self,
+	 double zoom,
+	 double px,
+	 double py);
 static void
-draw_crystal(CrystalView *self);
+render(CrystalView *self,
+       PixelRect r);
+static void
+scroll_pixels(CrystalView *self,
+	      int dx,
+	      int dy);
+static int
+add_new_ions(CrystalView *self,
+	     PixelRect *dirty);
+static PixelRect
+block_pixels(CrystalView const *self,
+	     Point cell,
+	     unsigned level);
+static PixelRect
+clip_pixels(CrystalView const *self,
+	    PixelRect r);
+static void
+queue_pixels(CrystalView *self,
+	     PixelRect r);
+static double
+cell_left(CrystalView const *self,
+	  Point cell,
+	  unsigned level);
+static Point
+walker_cell(CrystalView *self);
+static gboolean
+tick_cb(GtkWidget *widget,
+	GdkFrameClock *clock,
+	gpointer data);
+static void
+draw_edge(CrystalView *self,
+	  cairo_t *cr);
+static void
+draw_stats(CrystalView *self,
+	   cairo_t *cr);
 static gboolean
 draw_cb(GtkWidget *widget,
 	cairo_t *cr,
@@ -34,16 +131,33 @@ static gboolean
 configure_event_cb(GtkWidget *widget,
 		   GdkEventConfigure *event,
 		   gpointer data);
+static gboolean
+scroll_event_cb(GtkWidget *widget,
+		GdkEventScroll *event,
+		gpointer data);
+static gboolean
+button_press_event_cb(GtkWidget *widget,
+		      GdkEventButton *event,
+		      gpointer data);
+static gboolean
+motion_notify_event_cb(GtkWidget *widget,
+		       GdkEventMotion *event,
+		       gpointer data);
 
 CrystalView *
 CrystalView_create(CrystalModel *cm)
 {
   CrystalView *self = (CrystalView *)calloc(1, sizeof(CrystalView));
   self->_cm = cm;
-  
-  self->_width = CrystalModel_get_bath_width(self->_cm);
-  self->_height = CrystalModel_get_bath_width(self->_cm);
-  
+
+  self->_bath_width = CrystalModel_get_bath_width(self->_cm);
+  self->_site_width = CrystalModel_get_site_width(self->_cm);
+  self->_pyramid = DensityPyramid_create(CrystalModel_get_bath(self->_cm));
+  self->_fitted = 1;
+  CrystalModel_set_ion_log(self->_cm, 1);
+  pthread_mutex_init(&self->_stats_lock, NULL);
+  CrystalView_publish_stats(self);
+
   return self;
 }
 
@@ -52,80 +166,377 @@ CrystalView_destroy(CrystalView *self)
 {
   if (!self) { return; }
 
-  cairo_destroy(self->_cr);
   cairo_surface_destroy(self->_surface);
+  DensityPyramid_destroy(self->_pyramid);
+  pthread_mutex_destroy(&self->_stats_lock);
   free(self);
 }
 
 void
 CrystalView_repaint(CrystalView *self)
 {
-  gtk_widget_queue_draw(self->_canvas);
+  PixelRect dirty;
+  Point walker;
+
+  if (!self->_surface) {
+    gtk_widget_queue_draw(self->_canvas);
+    return;
+  }
+  if (add_new_ions(self, &dirty)) {
+    queue_pixels(self, dirty);
+  }
+  walker = walker_cell(self);
+  queue_pixels(self, block_pixels(self, self->_walker, 0));
+  queue_pixels(self, block_pixels(self, walker, 0));
+  gtk_widget_queue_draw_area(self->_canvas, 0, 0, self->_width, STATS_HEIGHT);
+  self->_shown_epoch = __atomic_load_n(&self->_stats_epoch, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Formats the statistics on the thread that owns the model. Skipped when
+ * the main loop is drawing them, so the simulation never waits for it.
+ */
+void
+CrystalView_publish_stats(CrystalView *self)
+{
+  CrystalStats stats;
+  ClusterStats cluster;
+  char lines[2][128];
+
+  CrystalModel_get_cluster_stats(self->_cm, &cluster);
+  ClusterStats_summary(&cluster, lines[0], sizeof(lines[0]));
+  CrystalModel_get_stats(self->_cm, &stats);
+  lines[1][0] = '\0';
+  if (stats.enabled) {
+    CrystalStats_summary(&stats, lines[1], sizeof(lines[1]));
+  }
+  if (pthread_mutex_trylock(&self->_stats_lock) == 0) {
+    memcpy(self->_stats, lines, sizeof(lines));
+    pthread_mutex_unlock(&self->_stats_lock);
+    __atomic_add_fetch(&self->_stats_epoch, 1, __ATOMIC_RELEASE);
+  }
 }
 
 void
 CrystalView_set_gtk_widget(CrystalView *self, GtkWidget *widget)
 {
+  unsigned const request = self->_bath_width < MAX_REQUEST ? self->_bath_width : MAX_REQUEST;
   self->_canvas = widget;
-  
-  gtk_widget_set_size_request(self->_canvas,
-			      CrystalModel_get_bath_width(self->_cm),
-			      CrystalModel_get_bath_width(self->_cm));
+
+  gtk_widget_set_size_request(self->_canvas, request, request);
+  gtk_widget_add_events(self->_canvas,
+			GDK_SCROLL_MASK | GDK_BUTTON_PRESS_MASK | GDK_BUTTON1_MOTION_MASK);
   g_signal_connect(self->_canvas, "draw", G_CALLBACK(draw_cb), self);
   g_signal_connect(self->_canvas, "configure-event", G_CALLBACK(configure_event_cb), self);
+  g_signal_connect(self->_canvas, "scroll-event", G_CALLBACK(scroll_event_cb), self);
+  g_signal_connect(self->_canvas, "button-press-event", G_CALLBACK(button_press_event_cb), self);
+  g_signal_connect(self->_canvas, "motion-notify-event", G_CALLBACK(motion_notify_event_cb), self);
+  gtk_widget_add_tick_callback(self->_canvas, tick_cb, self, NULL);
 }
 
+/* Shows the whole bath in the middle of the widget. */
 static void
-draw_background(CrystalView *self)
+fit_view(CrystalView *self)
 {
-  cairo_set_source_rgb(self->_cr, 0, 0, 0);
-  cairo_paint(self->_cr);
+  double const across = self->_bath_width * self->_site_width;
+  double const zoom = fmax(across / self->_width, (double)self->_bath_width / self->_height);
+
+  self->_x0 = 0.5 * (across - zoom * self->_width);
+  self->_y0 = 0.5 * (self->_bath_width - zoom * self->_height);
+  self->_pan_x = self->_pan_y = 0;
+  self->_zoom = zoom;
+  set_zoom(self, zoom, 0, 0);
+  self->_fitted = 1;
 }
 
+/*
+ * Zooms to `zoom` cells per pixel, or as close as allowed, keeping the
+ * cell under pixel (px, py) in place. Pixels are sampled from the level
+ * whose blocks are at least a pixel wide, so that no ion is skipped.
+ */
 static void
-draw_edge(CrystalView *self)
+set_zoom(CrystalView *self,
+	 double zoom,
+	 double px,
+	 double py)
 {
-  Point p = { CrystalModel_x_bath_to_model_rep(self->_cm, 0),
-	      CrystalModel_y_bath_to_model_rep(self->_cm, 0) };
-  cairo_set_line_width(self->_cr, 1);
-  
-  cairo_arc(self->_cr, p.x, p.y, CrystalModel_get_radius(self->_cm), 0, 2 * M_PI);
-  cairo_set_source_rgb(self->_cr, 0, 0, 1);
-  cairo_stroke(self->_cr);
-  
-  cairo_arc(self->_cr, p.x, p.y, CrystalModel_get_r_bounds(self->_cm), 0, 2 * M_PI);
-  cairo_set_source_rgb(self->_cr, 1, 1, 0);
-  cairo_stroke(self->_cr);
+  double const fit = fmax(self->_bath_width * self->_site_width / self->_width,
+			  (double)self->_bath_width / self->_height);
+  double const x = self->_x0 + (self->_pan_x + px) * self->_zoom;
+  double const y = self->_y0 + (self->_pan_y + py) * self->_zoom;
+  unsigned const top = DensityPyramid_get_levels(self->_pyramid) - 1;
+
+  zoom = zoom < fmin(MIN_ZOOM, fit) ? fmin(MIN_ZOOM, fit) : zoom > 2 * fit ? 2 * fit : zoom;
+  self->_zoom = zoom;
+  self->_x0 = x - px * zoom;
+  self->_y0 = y - py * zoom;
+  self->_pan_x = self->_pan_y = 0;
+  self->_level = zoom <= 1 ? 0 : (unsigned)ceil(log2(zoom) - 1e-9);
+  self->_level = self->_level > top ? top : self->_level;
+  self->_density = ldexp(1, -2 * (int)self->_level);
+  self->_fitted = 0;
 }
 
+/* Samples the pixels of `r` from the pyramid. */
 static void
-draw_crystal(CrystalView *self)
-{
-  int i, j;
-  int const x_l = CrystalModel_get_x(self->_cm), y_l = CrystalModel_get_y(self->_cm);
-  long const r = CrystalModel_get_radius(self->_cm);
-  
-  cairo_set_line_width(self->_cr, 0);
-  
-  for(i = -r; i <= r; i++) {
-    for(j = -r; j <= r; j++) {
-      if (CrystalModel_get_model_value(self->_cm, i, j)) {
-	cairo_rectangle(self->_cr,
-			CrystalModel_x_bath_to_model_rep(self->_cm, i),
-			CrystalModel_y_bath_to_model_rep(self->_cm, j),
-			1, 1);
+render(CrystalView *self,
+       PixelRect r)
+{
+  unsigned const level = self->_level;
+  double const across = self->_bath_width * self->_site_width;
+  unsigned char *data;
+  int stride;
+
+  r = clip_pixels(self, r);
+  if (r.x0 >= r.x1 || r.y0 >= r.y1) {
+    return;
+  }
+  cairo_surface_flush(self->_surface);
+  data = cairo_image_surface_get_data(self->_surface);
+  stride = cairo_image_surface_get_stride(self->_surface);
+  for (int py = r.y0; py < r.y1; ++py) {
+    uint32_t *row = (uint32_t *)(data + (size_t)py * stride);
+    double const y = self->_y0 + (self->_pan_y + py + 0.5) * self->_zoom;
+    for (int px = r.x0; px < r.x1; ++px) {
+      double const x = self->_x0 + (self->_pan_x + px + 0.5) * self->_zoom;
+      uint32_t count = 0;
+      if (self->_site_width != 1 && x >= 0 && y >= 0 && x < across && y < self->_bath_width) {
+	/* Single sites sit in their shifted rows, blocks of them are close enough. */
+	Point const row = { 0, (int)y };
+	double const col = x / self->_site_width - (level == 0 ? cell_left(self, row, 0) : 0);
+	if (col >= 0) {
+	  count = DensityPyramid_get_count(self->_pyramid, level,
+					   (unsigned)col >> level, (unsigned)y >> level);
+	}
+      } else if (x >= 0 && y >= 0 && x < self->_bath_width && y < self->_bath_width) {
+	count = DensityPyramid_get_count(self->_pyramid, level,
+					 (unsigned)x >> level, (unsigned)y >> level);
       }
+      row[px] = (uint32_t)(255 * sqrt(count * self->_density)) << DENSITY_SHIFT;
     }
   }
-  cairo_set_source_rgb(self->_cr, 1, 0, 0);
-  cairo_fill(self->_cr);
-        
-  cairo_rectangle(self->_cr,
-		  CrystalModel_x_bath_to_model_rep(self->_cm, x_l),
-		  CrystalModel_y_bath_to_model_rep(self->_cm, y_l),
-		  1, 1);
-  cairo_set_source_rgb(self->_cr, 0, 1, 0);
-  cairo_fill(self->_cr);
+  cairo_surface_mark_dirty_rectangle(self->_surface, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+}
+
+/* Moves the picture by (dx, dy) pixels and samples the strips exposed. */
+static void
+scroll_pixels(CrystalView *self,
+	      int dx,
+	      int dy)
+{
+  int const w = self->_width, h = self->_height;
+  int const from_x = dx > 0 ? 0 : -dx, to_x = dx > 0 ? dx : 0;
+  unsigned char *data;
+  int stride;
+
+  self->_pan_x -= dx;
+  self->_pan_y -= dy;
+  if (abs(dx) >= w || abs(dy) >= h) {
+    render(self, (PixelRect){ 0, 0, w, h });
+    return;
+  }
+  cairo_surface_flush(self->_surface);
+  data = cairo_image_surface_get_data(self->_surface);
+  stride = cairo_image_surface_get_stride(self->_surface);
+  for (int i = 0; i < h - abs(dy); ++i) {
+    int const y = dy > 0 ? h - 1 - i : i;
+    memmove(data + (size_t)y * stride + 4 * to_x,
+	    data + (size_t)(y - dy) * stride + 4 * from_x,
+	    4 * (size_t)(w - abs(dx)));
+  }
+  cairo_surface_mark_dirty(self->_surface);
+  render(self, dy > 0 ? (PixelRect){ 0, 0, w, dy } : (PixelRect){ 0, h + dy, w, h });
+  render(self, dx > 0 ? (PixelRect){ 0, 0, dx, h } : (PixelRect){ w + dx, 0, w, h });
+}
+
+/*
+ * Adds the ions logged since the last call to the pyramid, after
+ * clearing it if the model was reset, and samples the pixels over their
+ * blocks again. Returns 0 when nothing changed, otherwise the changed
+ * pixels are within *dirty.
+ */
+static int
+add_new_ions(CrystalView *self,
+	     PixelRect *dirty)
+{
+  uint64_t const n = CrystalModel_get_logged_ions(self->_cm);
+  PixelRect const all = { 0, 0, (int)self->_width, (int)self->_height };
+  int full = 0;
+
+  if (n < self->_drawn) {
+    DensityPyramid_clear(self->_pyramid);
+    self->_drawn = 0;
+    full = 1;
+  }
+  if (n == self->_drawn && !full) {
+    return 0;
+  }
+  /* Past an ion for every few pixels, sampling them all is cheaper. */
+  full |= n - self->_drawn > (uint64_t)self->_width * self->_height / 16;
+
+  dirty->x0 = dirty->y0 = INT_MAX;
+  dirty->x1 = dirty->y1 = INT_MIN;
+  for (uint64_t i = self->_drawn; i < n; ++i) {
+    Point const ion = CrystalModel_get_logged_ion(self->_cm, i);
+    Point const c = { CrystalModel_x_bath_to_model_rep(self->_cm, ion.x),
+		      CrystalModel_y_bath_to_model_rep(self->_cm, ion.y) };
+    PixelRect r;
+    DensityPyramid_add(self->_pyramid, c.x, c.y);
+    if (full) {
+      continue;
+    }
+    r = clip_pixels(self, block_pixels(self, c, self->_level));
+    if (r.x0 < r.x1 && r.y0 < r.y1) {
+      render(self, r);
+      dirty->x0 = r.x0 < dirty->x0 ? r.x0 : dirty->x0;
+      dirty->y0 = r.y0 < dirty->y0 ? r.y0 : dirty->y0;
+      dirty->x1 = r.x1 > dirty->x1 ? r.x1 : dirty->x1;
+      dirty->y1 = r.y1 > dirty->y1 ? r.y1 : dirty->y1;
+    }
+  }
+  self->_drawn = n;
+  if (full) {
+    render(self, all);
+    *dirty = all;
+  }
+  return dirty->x0 < dirty->x1;
+}
+
+/* Pixels covering the block of `level` that holds `cell`, at least one. */
+static PixelRect
+block_pixels(CrystalView const *self,
+	     Point cell,
+	     unsigned level)
+{
+  double const x0 = cell_left(self, cell, level) * self->_site_width;
+  double const y0 = (double)(cell.y >> level << level);
+  double const side = (double)(1u << level);
+  double const lo_x = (x0 - self->_x0) / self->_zoom - self->_pan_x;
+  double const lo_y = (y0 - self->_y0) / self->_zoom - self->_pan_y;
+  double const hi_x = (x0 + side * self->_site_width - self->_x0) / self->_zoom - self->_pan_x;
+  double const hi_y = (y0 + side - self->_y0) / self->_zoom - self->_pan_y;
+  PixelRect r;
+
+  /* Far outside the widget, only its side matters. */
+  r.x0 = (int)floor(fmax(fmin(lo_x, INT_MAX / 2), -1));
+  r.y0 = (int)floor(fmax(fmin(lo_y, INT_MAX / 2), -1));
+  r.x1 = (int)ceil(fmax(fmin(hi_x, INT_MAX / 2), -1));
+  r.y1 = (int)ceil(fmax(fmin(hi_y, INT_MAX / 2), -1));
+  r.x1 = r.x1 > r.x0 ? r.x1 : r.x0 + 1;
+  r.y1 = r.y1 > r.y0 ? r.y1 : r.y0 + 1;
+  return r;
+}
+
+/*
+ * Left edge of the block of `level` holding `cell`, in sites: single
+ * sites of shifted rows start half a site further.
+ */
+static double
+cell_left(CrystalView const *self,
+	  Point cell,
+	  unsigned level)
+{
+  double px, py;
+
+  if (level > 0 || self->_site_width == 1) {
+    return (double)(cell.x >> level << level);
+  }
+  CrystalModel_get_position(self->_cm, 0, (int)(self->_bath_width / 2) - cell.y, &px, &py);
+  return cell.x + px / self->_site_width;
+}
+
+static PixelRect
+clip_pixels(CrystalView const *self,
+	    PixelRect r)
+{
+  r.x0 = r.x0 < 0 ? 0 : r.x0;
+  r.y0 = r.y0 < 0 ? 0 : r.y0;
+  r.x1 = r.x1 > (int)self->_width ? (int)self->_width : r.x1;
+  r.y1 = r.y1 > (int)self->_height ? (int)self->_height : r.y1;
+  return r;
+}
+
+static void
+queue_pixels(CrystalView *self,
+	     PixelRect r)
+{
+  r = clip_pixels(self, r);
+  if (r.x0 < r.x1 && r.y0 < r.y1) {
+    gtk_widget_queue_draw_area(self->_canvas, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0);
+  }
+}
+
+/* The walker is shown where it stuck, the last logged ion. */
+static Point
+walker_cell(CrystalView *self)
+{
+  uint64_t const n = CrystalModel_get_logged_ions(self->_cm);
+  Point ion, p;
+
+  if (n == 0) {
+    return self->_walker;
+  }
+  ion = CrystalModel_get_logged_ion(self->_cm, n - 1);
+  p.x = CrystalModel_x_bath_to_model_rep(self->_cm, ion.x);
+  p.y = CrystalModel_y_bath_to_model_rep(self->_cm, ion.y);
+  return p;
+}
+
+/* Repaints at most MAX_FPS times a second, and only when something changed. */
+static gboolean
+tick_cb(GtkWidget *widget,
+	GdkFrameClock *clock,
+	gpointer data)
+{
+  CrystalView *self = (CrystalView *)data;
+  gint64 const now = gdk_frame_clock_get_frame_time(clock);
+  (void)widget;
+
+  if (self->_surface && now - self->_last_frame >= G_USEC_PER_SEC / MAX_FPS &&
+      (CrystalModel_get_logged_ions(self->_cm) != self->_drawn ||
+       __atomic_load_n(&self->_stats_epoch, __ATOMIC_ACQUIRE) != self->_shown_epoch)) {
+    self->_last_frame = now;
+    CrystalView_repaint(self);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* Start and escape circles, as vectors at any zoom. */
+static void
+draw_edge(CrystalView *self,
+	  cairo_t *cr)
+{
+  double const x = ((CrystalModel_x_bath_to_model_rep(self->_cm, 0) + 0.5) * self->_site_width -
+		    self->_x0) / self->_zoom - self->_pan_x;
+  double const y = (CrystalModel_y_bath_to_model_rep(self->_cm, 0) + 0.5 - self->_y0) / self->_zoom
+    - self->_pan_y;
+  cairo_set_line_width(cr, 1);
+
+  cairo_arc(cr, x, y, CrystalModel_get_radius(self->_cm) / self->_zoom, 0, 2 * M_PI);
+  cairo_set_source_rgb(cr, 0, 0, 1);
+  cairo_stroke(cr);
+
+  cairo_arc(cr, x, y, CrystalModel_get_r_bounds(self->_cm) / self->_zoom, 0, 2 * M_PI);
+  cairo_set_source_rgb(cr, 1, 1, 0);
+  cairo_stroke(cr);
+}
+
+/* Shape and per ion averages in the top left corner. */
+static void
+draw_stats(CrystalView *self,
+	   cairo_t *cr)
+{
+  char lines[2][128];
+
+  pthread_mutex_lock(&self->_stats_lock);
+  memcpy(lines, self->_stats, sizeof(lines));
+  pthread_mutex_unlock(&self->_stats_lock);
+  cairo_set_font_size(cr, 12);
+  cairo_set_source_rgb(cr, 1, 1, 1);
+  for (int i = 0; i < 2; ++i) {
+    cairo_move_to(cr, 4, 14 + 16 * i);
+    cairo_show_text(cr, lines[i]);
+  }
 }
 
 static gboolean
@@ -134,22 +545,28 @@ draw_cb(GtkWidget *widget,
 	gpointer data)
 {
   CrystalView *self;
+  PixelRect walker;
   (void)widget;
-  
+
   if (!data) {
     return FALSE;
   }
   self = (CrystalView *)data;
-  draw_background(self);
-  draw_edge(self);
-  draw_crystal(self);
-  
-  if (self->_scale_required) {
-    cairo_scale(cr, self->_x_scale, self->_y_scale);
+  if (!self->_surface) {
+    return FALSE;
   }
+
   cairo_set_source_surface(cr, self->_surface, 0, 0);
   cairo_paint(cr);
-  
+  draw_edge(self, cr);
+
+  self->_walker = walker_cell(self);
+  walker = block_pixels(self, self->_walker, 0);
+  cairo_rectangle(cr, walker.x0, walker.y0, walker.x1 - walker.x0, walker.y1 - walker.y0);
+  cairo_set_source_rgb(cr, 0, 1, 0);
+  cairo_fill(cr);
+  draw_stats(self, cr);
+
   return FALSE;
 }
 
@@ -161,26 +578,91 @@ configure_event_cb(GtkWidget *widget,
   CrystalView *self;
   unsigned width, height;
   (void)event;
-  
+
   if (!data) {
     return FALSE;
   }
   self = (CrystalView *)data;
-  
+
   width = gtk_widget_get_allocated_width(widget);
   height = gtk_widget_get_allocated_height(widget);
-  self->_scale_required = (width != self->_width || height != self->_height);
-  self->_x_scale = (double) width / (double) self->_width;
-  self->_y_scale = (double) height / (double) self->_height;
-
-  if (self->_surface) {
+  if (width == 0 || height == 0 ||
+      (self->_surface && width == self->_width && height == self->_height)) {
     return TRUE;
   }
-  
-  self->_surface = gdk_window_create_similar_surface(gtk_widget_get_window(self->_canvas),
-						      CAIRO_CONTENT_COLOR,
-						      self->_width,
-						      self->_height);
-  self->_cr = cairo_create(self->_surface);
+
+  /* The surface always matches the widget, whatever the bath size. */
+  cairo_surface_destroy(self->_surface);
+  self->_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+  self->_width = width;
+  self->_height = height;
+  if (self->_fitted) {
+    fit_view(self);
+  } else {
+    set_zoom(self, self->_zoom, 0, 0);
+  }
+  render(self, (PixelRect){ 0, 0, (int)width, (int)height });
+  CrystalView_repaint(self);
+  return TRUE;
+}
+
+/* The wheel zooms around the pointer. */
+static gboolean
+scroll_event_cb(GtkWidget *widget,
+		GdkEventScroll *event,
+		gpointer data)
+{
+  CrystalView *self = (CrystalView *)data;
+
+  if (!self->_surface ||
+      (event->direction != GDK_SCROLL_UP && event->direction != GDK_SCROLL_DOWN)) {
+    return FALSE;
+  }
+  set_zoom(self, event->direction == GDK_SCROLL_UP ? self->_zoom / ZOOM_STEP : self->_zoom * ZOOM_STEP,
+	   event->x, event->y);
+  render(self, (PixelRect){ 0, 0, (int)self->_width, (int)self->_height });
+  gtk_widget_queue_draw(widget);
+  return TRUE;
+}
+
+/* Dragging with the first button pans, double clicking shows the whole bath. */
+static gboolean
+button_press_event_cb(GtkWidget *widget,
+		      GdkEventButton *event,
+		      gpointer data)
+{
+  CrystalView *self = (CrystalView *)data;
+
+  if (!self->_surface || event->button != 1) {
+    return FALSE;
+  }
+  if (event->type == GDK_2BUTTON_PRESS) {
+    fit_view(self);
+    render(self, (PixelRect){ 0, 0, (int)self->_width, (int)self->_height });
+    gtk_widget_queue_draw(widget);
+  }
+  self->_drag_x = event->x;
+  self->_drag_y = event->y;
+  return TRUE;
+}
+
+static gboolean
+motion_notify_event_cb(GtkWidget *widget,
+		       GdkEventMotion *event,
+		       gpointer data)
+{
+  CrystalView *self = (CrystalView *)data;
+  int const dx = (int)(event->x - self->_drag_x), dy = (int)(event->y - self->_drag_y);
+
+  if (!self->_surface || !(event->state & GDK_BUTTON1_MASK)) {
+    return FALSE;
+  }
+  if (dx != 0 || dy != 0) {
+    scroll_pixels(self, dx, dy);
+    self->_drag_x += dx;
+    self->_drag_y += dy;
+    self->_fitted = 0;
+    gtk_widget_queue_draw(widget);
+  }
   return TRUE;
 }
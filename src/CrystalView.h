@@ -12,6 +12,12 @@ extern void
 CrystalView_destroy(CrystalView *self);
 extern void
 CrystalView_repaint(CrystalView *self);
+/*
+ * Updates the statistics shown over the crystal. Called by the thread
+ * that grows the crystal, between batches; never blocks on the GUI.
+ */
+extern void
+CrystalView_publish_stats(CrystalView *self);
 extern void
 CrystalView_set_gtk_widget(CrystalView *self,
 			   GtkWidget *widget);
@@ -0,0 +1,660 @@
+#include "CrystalWriter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*
+ * Every format is a set of callbacks fed one row of cells at a time:
+ * 0 for empty, 1 for the crystal and 2 for the last ion, or the grey
+ * level of each ion for formats shaded by age.
+ */
+
+/* Largest payload of a deflate stored block. */
+#define STORED_BLOCK 65535
+
+typedef struct
+{
+  FILE *out;
+  int x0;          /* bath coordinates of the top left cell */
+  int y0;
+  unsigned width;
+  unsigned height;
+  unsigned char *buf; /* one encoded row */
+  uint32_t adler;
+} WriterState;
+
+/* Fills the cells of row `y` of the picture. */
+typedef void (*RowSource)(void const *src, WriterState const *st, int y, matrix_t *cells);
+
+/* The crystal of a model, or of a replay cut after `ions` ions. */
+typedef struct
+{
+  CrystalModel const *cm;
+  CrystalReplay const *replay;
+  uint64_t ions;
+  int by_age;
+  double shade;     /* grey levels per ion of age */
+  int x;            /* last ion */
+  int y;
+} ModelSource;
+
+typedef struct
+{
+  char const *name;
+  int crystal_only;   /* covers the crystal rather than the bath */
+  int by_age;         /* cells hold grey levels from the arrival indices */
+  void (*begin)(WriterState *st);
+  void (*row)(WriterState *st, int y, matrix_t const *cells);
+  void (*end)(WriterState *st);
+} WriterOps;
+
+static void
+text_begin(WriterState *st);
+static void
+text_row(WriterState *st,
+	 int y,
+	 matrix_t const *cells);
+static void
+pbm_begin(WriterState *st);
+static void
+pbm_row(WriterState *st,
+	int y,
+	matrix_t const *cells);
+static void
+pgm_begin(WriterState *st);
+static void
+pgm_row(WriterState *st,
+	int y,
+	matrix_t const *cells);
+static void
+png_begin(WriterState *st);
+static void
+png_row(WriterState *st,
+	int y,
+	matrix_t const *cells);
+static void
+png_end(WriterState *st);
+static int
+write_rows(CrystalModel const *cm,
+	   CrystalReplay const *replay,
+	   uint64_t ions,
+	   CrystalWriterFormat format,
+	   FILE *out);
+static int
+write_picture(WriterOps const *ops,
+	      int r,
+	      RowSource source,
+	      void const *src,
+	      FILE *out);
+static matrix_t
+site_value(ModelSource const *m,
+	   int x,
+	   int y);
+static void
+model_row(void const *src,
+	  WriterState const *st,
+	  int y,
+	  matrix_t *cells);
+static void
+plane_row(void const *src,
+	  WriterState const *st,
+	  int y,
+	  matrix_t *cells);
+static int
+write_sites(ModelSource const *src,
+	    int r,
+	    FILE *out);
+static void
+projection_row(void const *src,
+	       WriterState const *st,
+	       int y,
+	       matrix_t *cells);
+static int
+write_voxels(CrystalModel3D const *cm,
+	     FILE *out);
+static int
+write_discs(CrystalModel const *cm,
+	    FILE *out);
+static void
+age_row(WriterState *st,
+	int y,
+	matrix_t const *cells);
+static void
+points_begin(WriterState *st);
+static void
+points_row(WriterState *st,
+	   int y,
+	   matrix_t const *cells);
+static unsigned
+pack_bits(unsigned char *dst,
+	  matrix_t const *cells,
+	  unsigned n);
+static void
+png_chunk(FILE *out,
+	  char const *type,
+	  unsigned char const *data,
+	  uint32_t len);
+static unsigned char *
+put_be32(unsigned char *p,
+	 uint32_t v);
+static uint32_t
+crc32_update(uint32_t crc,
+	     unsigned char const *p,
+	     size_t n);
+
+static WriterOps const writers[] = {
+  [CRYSTAL_WRITER_TEXT] = { "txt", 0, 0, text_begin, text_row, text_begin },
+  [CRYSTAL_WRITER_PBM] = { "pbm", 0, 0, pbm_begin, pbm_row, NULL },
+  [CRYSTAL_WRITER_PGM] = { "pgm", 0, 0, pgm_begin, pgm_row, NULL },
+  [CRYSTAL_WRITER_PNG] = { "png", 0, 0, png_begin, png_row, png_end },
+  [CRYSTAL_WRITER_POINTS] = { "points", 1, 0, points_begin, points_row, NULL },
+  [CRYSTAL_WRITER_AGE] = { "age", 0, 1, pgm_begin, age_row, NULL },
+  /* Not made of rows, see write_discs. */
+  [CRYSTAL_WRITER_DISCS] = { "discs", 1, 0, NULL, NULL, NULL },
+};
+
+extern int
+CrystalWriter_parse_format(char const *name,
+			   CrystalWriterFormat *format)
+{
+  for (size_t i = 0; i < sizeof(writers)/sizeof(writers[0]); ++i) {
+    if (strcmp(name, writers[i].name) == 0) {
+      *format = (CrystalWriterFormat)i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+extern int
+CrystalWriter_write(CrystalModel const *cm,
+		    CrystalWriterFormat format,
+		    FILE *out)
+{
+  CrystalReplay *replay;
+  int ret;
+
+  if (format == CRYSTAL_WRITER_DISCS) {
+    return write_discs(cm, out);
+  }
+  if (!writers[format].by_age) {
+    return write_rows(cm, NULL, 0, format, out);
+  }
+  if (!(replay = CrystalReplay_create(cm))) {
+    return -1;
+  }
+  ret = write_rows(cm, replay, CrystalReplay_get_ions(replay), format, out);
+  CrystalReplay_destroy(replay);
+  return ret;
+}
+
+extern int
+CrystalWriter_write_replay(CrystalModel const *cm,
+			   CrystalReplay const *replay,
+			   uint64_t ions,
+			   CrystalWriterFormat format,
+			   FILE *out)
+{
+  if (format == CRYSTAL_WRITER_DISCS) {
+    return -1;
+  }
+  return write_rows(cm, replay, ions, format, out);
+}
+
+/* Centres in sticking order, with enough digits to read them back exactly. */
+static int
+write_discs(CrystalModel const *cm,
+	    FILE *out)
+{
+  uint64_t const n = CrystalModel_get_discs(cm);
+  double x, y;
+
+  if (CrystalModel_get_lattice(cm) != CRYSTAL_LATTICE_OFF) {
+    return -1;
+  }
+  for (uint64_t i = 0; i < n; ++i) {
+    CrystalModel_get_disc(cm, i, &x, &y);
+    fprintf(out, "%.17g %.17g\n", x, y);
+  }
+  return ferror(out) ? -1 : 0;
+}
+
+/* Cells come from the model, or from `replay` cut after `ions` ions. */
+static int
+write_rows(CrystalModel const *cm,
+	   CrystalReplay const *replay,
+	   uint64_t ions,
+	   CrystalWriterFormat format,
+	   FILE *out)
+{
+  WriterOps const *ops = &writers[format];
+  int const r = ops->crystal_only ?
+    (int)CrystalModel_get_crystal_radius(cm) + 1 : (int)CrystalModel_get_radius(cm);
+  ModelSource src;
+
+  src.cm = cm;
+  src.replay = replay;
+  src.ions = ions;
+  src.by_age = ops->by_age;
+  src.shade = ions > 1 ? 191.0 / (ions - 1) : 0;
+  src.x = CrystalModel_get_x(cm);
+  src.y = CrystalModel_get_y(cm);
+  if (CrystalModel_get_site_width(cm) == 1) {
+    return write_picture(ops, r, model_row, &src, out);
+  }
+  /* Sites wider than a row is high are drawn to scale, listed by position. */
+  if (format == CRYSTAL_WRITER_POINTS) {
+    return write_sites(&src, r, out);
+  }
+  return write_picture(ops, r, plane_row, &src, out);
+}
+
+/* The square of side 2r around the seed, top row first. */
+static int
+write_picture(WriterOps const *ops,
+	      int r,
+	      RowSource source,
+	      void const *src,
+	      FILE *out)
+{
+  WriterState st;
+  matrix_t *cells;
+
+  st.out = out;
+  st.x0 = -r;
+  st.y0 = r - 1;
+  st.width = st.height = 2*r;
+  st.buf = (unsigned char *)malloc(2*st.width + 64);
+  st.adler = 1;
+  cells = (matrix_t *)malloc(st.width);
+
+  ops->begin(&st);
+  for (int j = st.y0; j > st.y0 - (int)st.height; --j) {
+    source(src, &st, j, cells);
+    ops->row(&st, j, cells);
+  }
+  if (ops->end) {
+    ops->end(&st);
+  }
+
+  free(cells);
+  free(st.buf);
+  return ferror(out) ? -1 : 0;
+}
+
+static matrix_t
+site_value(ModelSource const *m,
+	   int x,
+	   int y)
+{
+  uint32_t a;
+
+  if (!m->replay) {
+    return CrystalModel_get_model_value(m->cm, x, y) ? 1 + (x == m->x && y == m->y) : 0;
+  }
+  a = CrystalReplay_get_arrival(m->replay, x, y);
+  return (a == 0 || a > m->ions ? 0 :
+	  m->by_age ? (matrix_t)(255 - (m->ions - a) * m->shade) : 1 + (a == m->ions));
+}
+
+static void
+model_row(void const *src,
+	  WriterState const *st,
+	  int y,
+	  matrix_t *cells)
+{
+  ModelSource const *m = (ModelSource const *)src;
+
+  for (unsigned i = 0; i < st->width; ++i) {
+    cells[i] = site_value(m, st->x0 + (int)i, y);
+  }
+}
+
+/* Pixels a unit apart in the plane, each showing the site whose cell holds its centre. */
+static void
+plane_row(void const *src,
+	  WriterState const *st,
+	  int y,
+	  matrix_t *cells)
+{
+  ModelSource const *m = (ModelSource const *)src;
+  int sx, sy;
+
+  for (unsigned i = 0; i < st->width; ++i) {
+    CrystalModel_get_site(m->cm, st->x0 + (int)i + 0.5, y, &sx, &sy);
+    cells[i] = site_value(m, sx, sy);
+  }
+}
+
+/* One "x y" line per ion, at its position in the plane. */
+static int
+write_sites(ModelSource const *src,
+	    int r,
+	    FILE *out)
+{
+  double px, py;
+
+  fprintf(out, "# x y of every ion, sites within %d rows of the seed\n", r);
+  for (int y = r - 1; y >= -r; --y) {
+    for (int x = -r; x < r; ++x) {
+      if (site_value(src, x, y)) {
+	CrystalModel_get_position(src->cm, x, y, &px, &py);
+	fprintf(out, "%.17g %.17g\n", px, py);
+      }
+    }
+  }
+  return ferror(out) ? -1 : 0;
+}
+
+extern int
+CrystalWriter_write_volume(CrystalModel3D const *cm,
+			   CrystalWriterFormat format,
+			   FILE *out)
+{
+  WriterOps const *ops = &writers[format];
+
+  if (format == CRYSTAL_WRITER_POINTS) {
+    return write_voxels(cm, out);
+  }
+  if (ops->crystal_only || ops->by_age) {
+    return -1;
+  }
+  return write_picture(ops, (int)CrystalModel3D_get_crystal_radius(cm) + 1,
+		       projection_row, cm, out);
+}
+
+/*
+ * Columns along z holding a voxel, the one of the last ion marked. The
+ * bits of one column within a brick are one brick layer apart.
+ */
+static void
+projection_row(void const *src,
+	       WriterState const *st,
+	       int y,
+	       matrix_t *cells)
+{
+  CrystalModel3D const *cm = (CrystalModel3D const *)src;
+  Volume const *vol = CrystalModel3D_get_volume(cm);
+  unsigned const half = Volume_size(vol) / 2;
+  unsigned const r = CrystalModel3D_get_crystal_radius(cm);
+  unsigned const brick = 1u << VOLUME_BRICK_SHIFT;
+  uint64_t column = 0;
+  int lx, ly, lz;
+
+  CrystalModel3D_get_last(cm, &lx, &ly, &lz);
+  for (unsigned k = 0; k < brick; ++k) {
+    column |= UINT64_C(1) << (k << 2*VOLUME_BRICK_SHIFT);
+  }
+  for (unsigned i = 0; i < st->width; ++i) {
+    int const x = st->x0 + (int)i;
+    unsigned const vx = x + half, vy = y + half;
+    uint64_t const mask = column << Volume_voxel_bit(vx, vy, 0);
+    cells[i] = 0;
+    for (unsigned vz = (half - r) & ~(brick - 1); vz <= half + r; vz += brick) {
+      if (Volume_brick(vol, vx, vy, vz) & mask) {
+	cells[i] = 1 + (x == lx && y == ly);
+	break;
+      }
+    }
+  }
+}
+
+/* One "x y z" line per voxel, brick by brick. */
+static int
+write_voxels(CrystalModel3D const *cm,
+	     FILE *out)
+{
+  Volume const *vol = CrystalModel3D_get_volume(cm);
+  int const half = (int)Volume_size(vol) / 2;
+  int const r = (int)CrystalModel3D_get_crystal_radius(cm);
+  int const brick = 1 << VOLUME_BRICK_SHIFT;
+  int const lo = (half - r) & ~(brick - 1);
+
+  for (int z = lo; z <= half + r; z += brick) {
+    for (int y = lo; y <= half + r; y += brick) {
+      for (int x = lo; x <= half + r; x += brick) {
+	uint64_t b = Volume_brick(vol, x, y, z);
+	while (b) {
+	  unsigned const bit = __builtin_ctzll(b);
+	  b &= b - 1;
+	  fprintf(out, "%d %d %d\n",
+		  x + (int)(bit & VOLUME_BRICK_MASK) - half,
+		  y + (int)(bit >> VOLUME_BRICK_SHIFT & VOLUME_BRICK_MASK) - half,
+		  z + (int)(bit >> 2*VOLUME_BRICK_SHIFT) - half);
+	}
+      }
+    }
+  }
+  return ferror(out) ? -1 : 0;
+}
+
+/* Border line, both before and after the picture. */
+static void
+text_begin(WriterState *st)
+{
+  memset(st->buf, '-', st->width + 2);
+  st->buf[st->width + 2] = '\n';
+  fwrite(st->buf, 1, st->width + 3, st->out);
+}
+
+static void
+text_row(WriterState *st,
+	 int y,
+	 matrix_t const *cells)
+{
+  static char const glyphs[] = { ' ', '*', '#' };
+  (void)y;
+  st->buf[0] = '|';
+  for (unsigned i = 0; i < st->width; ++i) {
+    st->buf[i+1] = glyphs[cells[i]];
+  }
+  st->buf[st->width + 1] = '|';
+  st->buf[st->width + 2] = '\n';
+  fwrite(st->buf, 1, st->width + 3, st->out);
+}
+
+static void
+pbm_begin(WriterState *st)
+{
+  fprintf(st->out, "P4\n%u %u\n", st->width, st->height);
+}
+
+static void
+pbm_row(WriterState *st,
+	int y,
+	matrix_t const *cells)
+{
+  (void)y;
+  fwrite(st->buf, 1, pack_bits(st->buf, cells, st->width), st->out);
+}
+
+static void
+pgm_begin(WriterState *st)
+{
+  fprintf(st->out, "P5\n%u %u\n255\n", st->width, st->height);
+}
+
+static void
+pgm_row(WriterState *st,
+	int y,
+	matrix_t const *cells)
+{
+  static unsigned char const grey[] = { 0, 255, 128 };
+  (void)y;
+  for (unsigned i = 0; i < st->width; ++i) {
+    st->buf[i] = grey[cells[i]];
+  }
+  fwrite(st->buf, 1, st->width, st->out);
+}
+
+/* Grey levels straight from the cells, the crystal shaded by age. */
+static void
+age_row(WriterState *st,
+	int y,
+	matrix_t const *cells)
+{
+  (void)y;
+  fwrite(cells, 1, st->width, st->out);
+}
+
+/*
+ * PNG rows are deflated with stored blocks, one IDAT chunk per row, so
+ * the zlib stream never has to be held in memory. A 1-bit image keeps
+ * the file at the size of the PBM.
+ */
+static void
+png_begin(WriterState *st)
+{
+  static unsigned char const signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  unsigned char ihdr[13], *p = ihdr;
+
+  fwrite(signature, 1, sizeof(signature), st->out);
+  p = put_be32(p, st->width);
+  p = put_be32(p, st->height);
+  *p++ = 1;   /* bit depth */
+  *p++ = 0;   /* greyscale */
+  *p++ = 0;   /* deflate */
+  *p++ = 0;   /* adaptive filtering */
+  *p++ = 0;   /* no interlace */
+  png_chunk(st->out, "IHDR", ihdr, sizeof(ihdr));
+}
+
+static void
+png_row(WriterState *st,
+	int y,
+	matrix_t const *cells)
+{
+  unsigned char *p = st->buf;
+  unsigned char *raw;
+  unsigned len;
+  uint32_t a, b;
+
+  if (y == st->y0) {
+    *p++ = 0x78;   /* zlib header, 32K window, no dictionary */
+    *p++ = 0x01;
+  }
+  /* The raw row, filter type 0 and packed pixels, is written after the
+     room for its block headers and moved into place below. */
+  raw = st->buf + st->width + 32;
+  raw[0] = 0;
+  len = 1 + pack_bits(raw + 1, cells, st->width);
+
+  a = st->adler & 0xffff;
+  b = st->adler >> 16;
+  for (unsigned i = 0; i < len; ++i) {
+    a = (a + raw[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  st->adler = b << 16 | a;
+
+  for (unsigned done = 0; done < len; ) {
+    unsigned const n = len - done < STORED_BLOCK ? len - done : STORED_BLOCK;
+    *p++ = 0;   /* not final, stored */
+    *p++ = n & 0xff;
+    *p++ = n >> 8;
+    *p++ = ~n & 0xff;
+    *p++ = (~n >> 8) & 0xff;
+    memmove(p, raw + done, n);
+    p += n;
+    done += n;
+  }
+  png_chunk(st->out, "IDAT", st->buf, p - st->buf);
+}
+
+static void
+png_end(WriterState *st)
+{
+  unsigned char tail[9] = { 1, 0, 0, 0xff, 0xff };   /* empty final block */
+
+  put_be32(tail + 5, st->adler);
+  png_chunk(st->out, "IDAT", tail, sizeof(tail));
+  png_chunk(st->out, "IEND", NULL, 0);
+}
+
+static void
+points_begin(WriterState *st)
+{
+  fprintf(st->out, "# x y of every ion, %u x %u cells around the seed\n",
+	  st->width, st->height);
+}
+
+static void
+points_row(WriterState *st,
+	   int y,
+	   matrix_t const *cells)
+{
+  for (unsigned i = 0; i < st->width; ++i) {
+    if (cells[i]) {
+      fprintf(st->out, "%d %d\n", st->x0 + (int)i, y);
+    }
+  }
+}
+
+/* Packs one cell per bit, first cell in the high bit; returns bytes used. */
+static unsigned
+pack_bits(unsigned char *dst,
+	  matrix_t const *cells,
+	  unsigned n)
+{
+  unsigned const bytes = (n + 7) / 8;
+  memset(dst, 0, bytes);
+  for (unsigned i = 0; i < n; ++i) {
+    if (cells[i]) {
+      dst[i >> 3] |= 0x80 >> (i & 7);
+    }
+  }
+  return bytes;
+}
+
+static void
+png_chunk(FILE *out,
+	  char const *type,
+	  unsigned char const *data,
+	  uint32_t len)
+{
+  unsigned char word[4];
+  uint32_t crc;
+
+  fwrite(put_be32(word, len) - 4, 1, 4, out);
+  fwrite(type, 1, 4, out);
+  if (len) {
+    fwrite(data, 1, len, out);
+  }
+  crc = crc32_update(0xffffffffu, (unsigned char const *)type, 4);
+  crc = crc32_update(crc, data, len) ^ 0xffffffffu;
+  fwrite(put_be32(word, crc) - 4, 1, 4, out);
+}
+
+static unsigned char *
+put_be32(unsigned char *p,
+	 uint32_t v)
+{
+  *p++ = v >> 24;
+  *p++ = v >> 16;
+  *p++ = v >> 8;
+  *p++ = v;
+  return p;
+}
+
+static uint32_t
+crc32_update(uint32_t crc,
+	     unsigned char const *p,
+	     size_t n)
+{
+  static uint32_t table[256];
+
+  if (!table[1]) {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+	c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
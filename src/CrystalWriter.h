@@ -0,0 +1,66 @@
+#ifndef CRYSTALWRITER_H_
+#define CRYSTALWRITER_H_
+
+#include <stdio.h>
+
+#include "CrystalModel.h"
+#include "CrystalModel3D.h"
+#include "CrystalReplay.h"
+
+typedef enum
+{
+  CRYSTAL_WRITER_TEXT,  /* ASCII picture, like CrystalModel_to_string */
+  CRYSTAL_WRITER_PBM,   /* binary bitmap, crystal in black */
+  CRYSTAL_WRITER_PGM,   /* binary greymap, crystal in white, last ion in grey */
+  CRYSTAL_WRITER_PNG,   /* 1-bit greyscale PNG, crystal in white */
+  CRYSTAL_WRITER_POINTS, /* one "x y" line per ion */
+  CRYSTAL_WRITER_AGE,   /* binary greymap, older ions darker */
+  CRYSTAL_WRITER_DISCS  /* one "x y" line per disc of an off-lattice model */
+} CrystalWriterFormat;
+
+/*
+ * Returns 0 and sets *format if `name` is one of
+ * txt/pbm/pgm/png/points/age/discs.
+ */
+extern int
+CrystalWriter_parse_format(char const *name,
+			   CrystalWriterFormat *format);
+
+/*
+ * Writes the bath of `cm` row by row, top row first, keeping only one
+ * row in memory. Images cover the square of side 2 r_escape around the
+ * seed, the point list only the crystal. On CRYSTAL_LATTICE_HEX images
+ * are drawn to scale, a pixel per unit of the plane showing the site
+ * under it, and points are listed at their positions in the plane. CRYSTAL_WRITER_AGE needs the
+ * ion log of `cm`, CRYSTAL_WRITER_DISCS an off-lattice model. Returns 0
+ * on success, -1 on error.
+ */
+extern int
+CrystalWriter_write(CrystalModel const *cm,
+		    CrystalWriterFormat format,
+		    FILE *out);
+/*
+ * Writes the crystal as it was after its first `ions` ions, from the
+ * arrival indices of `replay`, over the same square as
+ * CrystalWriter_write, so that frames of one crystal line up. Takes
+ * time in the size of the picture, not in the growth. Not for
+ * CRYSTAL_WRITER_DISCS.
+ */
+extern int
+CrystalWriter_write_replay(CrystalModel const *cm,
+			   CrystalReplay const *replay,
+			   uint64_t ions,
+			   CrystalWriterFormat format,
+			   FILE *out);
+/*
+ * Writes the crystal of a three dimensional model: CRYSTAL_WRITER_POINTS
+ * streams one "x y z" line per voxel, the picture formats its projection
+ * along z over the square holding the crystal. Returns 0 on success, -1
+ * on error, including the other formats.
+ */
+extern int
+CrystalWriter_write_volume(CrystalModel3D const *cm,
+			   CrystalWriterFormat format,
+			   FILE *out);
+
+#endif //CRYSTALWRITER_H_
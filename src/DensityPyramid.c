@@ -0,0 +1,133 @@
+#include "DensityPyramid.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Levels below take most of the memory and are cheap to read from the bath. */
+#define FIRST_STORED_LEVEL 2
+#define MAX_LEVELS 33
+
+typedef struct
+{
+  void *counts;
+  unsigned width;   /* blocks per row */
+  unsigned bytes;   /* per count, the fewest that hold 4^level */
+} PyramidLevel;
+
+struct density_pyramid_t
+{
+  Matrix const *_bath;
+  unsigned _levels;
+  PyramidLevel _level[MAX_LEVELS];
+};
+
+static uint32_t
+bath_count(Matrix const *bath,
+	   unsigned x,
+	   unsigned y);
+
+extern DensityPyramid *
+DensityPyramid_create(Matrix const *bath)
+{
+  DensityPyramid *self = (DensityPyramid *)calloc(1, sizeof(DensityPyramid));
+  unsigned const size = Matrix_size(bath);
+
+  self->_bath = bath;
+  for (self->_levels = 1; (size - 1) >> (self->_levels - 1) > 0; ++self->_levels) {
+  }
+  for (unsigned l = FIRST_STORED_LEVEL; l < self->_levels; ++l) {
+    PyramidLevel *level = &self->_level[l];
+    level->width = ((size - 1) >> l) + 1;
+    level->bytes = l <= 3 ? 1 : l <= 7 ? 2 : 4;
+    level->counts = calloc((size_t)level->width * level->width, level->bytes);
+  }
+  return self;
+}
+
+extern void
+DensityPyramid_destroy(DensityPyramid *self)
+{
+  if (!self) { return; }
+
+  for (unsigned l = FIRST_STORED_LEVEL; l < self->_levels; ++l) {
+    free(self->_level[l].counts);
+  }
+  free(self);
+}
+
+extern void
+DensityPyramid_clear(DensityPyramid *self)
+{
+  for (unsigned l = FIRST_STORED_LEVEL; l < self->_levels; ++l) {
+    PyramidLevel *level = &self->_level[l];
+    memset(level->counts, 0, (size_t)level->width * level->width * level->bytes);
+  }
+}
+
+extern void
+DensityPyramid_add(DensityPyramid *self,
+		   unsigned x,
+		   unsigned y)
+{
+  for (unsigned l = FIRST_STORED_LEVEL; l < self->_levels; ++l) {
+    PyramidLevel *level = &self->_level[l];
+    size_t const i = (size_t)(y >> l) * level->width + (x >> l);
+    switch (level->bytes) {
+    case 1:
+      ((uint8_t *)level->counts)[i]++;
+      break;
+    case 2:
+      ((uint16_t *)level->counts)[i]++;
+      break;
+    default:
+      ((uint32_t *)level->counts)[i]++;
+      break;
+    }
+  }
+}
+
+extern unsigned
+DensityPyramid_get_levels(DensityPyramid const *self)
+{
+  return self->_levels;
+}
+
+extern uint32_t
+DensityPyramid_get_count(DensityPyramid const *self,
+			 unsigned level,
+			 unsigned x,
+			 unsigned y)
+{
+  PyramidLevel const *l = &self->_level[level];
+  size_t i;
+
+  if (level == 0) {
+    return bath_count(self->_bath, x, y);
+  }
+  if (level < FIRST_STORED_LEVEL) {
+    return (bath_count(self->_bath, 2*x, 2*y) + bath_count(self->_bath, 2*x + 1, 2*y) +
+	    bath_count(self->_bath, 2*x, 2*y + 1) + bath_count(self->_bath, 2*x + 1, 2*y + 1));
+  }
+  if (level >= self->_levels || x >= l->width || y >= l->width) {
+    return 0;
+  }
+  i = (size_t)y * l->width + x;
+  switch (l->bytes) {
+  case 1:
+    return ((uint8_t const *)l->counts)[i];
+  case 2:
+    return ((uint16_t const *)l->counts)[i];
+  default:
+    return ((uint32_t const *)l->counts)[i];
+  }
+}
+
+/* The view reads the bath while the simulation thread sets cells. */
+static uint32_t
+bath_count(Matrix const *bath,
+	   unsigned x,
+	   unsigned y)
+{
+  unsigned const size = Matrix_size(bath);
+  return x < size && y < size && Matrix_get_shared(bath, x, y) != 0;
+}
@@ -0,0 +1,38 @@
+#ifndef DENSITYPYRAMID_H_
+#define DENSITYPYRAMID_H_
+
+#include <inttypes.h>
+
+#include "Matrix.h"
+
+/*
+ * Occupied cells of a bath counted over blocks of 2^level x 2^level
+ * cells, a mipmap for drawing a crystal at any scale from about one
+ * count per pixel. Level 0 and 1 are read from the bath itself, higher
+ * levels are stored and kept up to date by DensityPyramid_add.
+ */
+typedef struct density_pyramid_t DensityPyramid;
+
+extern DensityPyramid *
+DensityPyramid_create(Matrix const *bath);
+extern void
+DensityPyramid_destroy(DensityPyramid *self);
+/* Forgets every cell added, for a bath that was cleared. */
+extern void
+DensityPyramid_clear(DensityPyramid *self);
+/* Counts the bath cell (x, y), which must be added only once. */
+extern void
+DensityPyramid_add(DensityPyramid *self,
+		   unsigned x,
+		   unsigned y);
+/* Levels 0 up to the one whose single block covers the bath. */
+extern unsigned
+DensityPyramid_get_levels(DensityPyramid const *self);
+/* Occupied cells of block (x, y) of `level`, 0 outside the bath. */
+extern uint32_t
+DensityPyramid_get_count(DensityPyramid const *self,
+			 unsigned level,
+			 unsigned x,
+			 unsigned y);
+
+#endif //DENSITYPYRAMID_H_
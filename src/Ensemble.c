@@ -0,0 +1,308 @@
+#include "Ensemble.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Longest "size,seed,escape_factor,lattice,rule" key of a job. */
+#define KEY_SIZE 96
+#define KEY_FIELDS 5
+/* Longest line of the result file. */
+#define LINE_SIZE 256
+
+static char const header[] =
+  "size,seed,escape_factor,lattice,rule,ions,steps,relaunches,crystal_radius,rg,fractal_dimension,seconds\n";
+static char const *const lattice_names[] = { "square", "off", "square8", "hex" };
+static char const *const rule_names[] = { "dla", "sticky", "noise", "ballistic", "eden" };
+
+/* Jobs of one worker; the owner takes from the head, thieves from the tail. */
+typedef struct
+{
+  pthread_mutex_t lock;
+  EnsembleJob *jobs;
+  size_t head;
+  size_t tail;
+} JobQueue;
+
+typedef struct
+{
+  EnsembleConfig const *config;
+  JobQueue *queues;
+  pthread_mutex_t out_lock;
+  FILE *out;
+  size_t done;
+  size_t total;
+} Pool;
+
+typedef struct
+{
+  Pool *pool;
+  unsigned id;
+  pthread_t thread;
+} Worker;
+
+static void *
+worker_main(void *arg);
+static int
+take_job(Pool *pool,
+	 unsigned id,
+	 EnsembleJob *job);
+static void
+job_key(EnsembleConfig const *config,
+	EnsembleJob const *job,
+	char *key);
+static int
+compare_keys(void const *a,
+	     void const *b);
+static int
+compare_sizes(void const *a,
+	      void const *b);
+static long
+read_finished(char const *path,
+	      char **keys,
+	      size_t *n_keys);
+
+extern int
+Ensemble_run(EnsembleConfig const *config,
+	     size_t const *sizes,
+	     size_t n_sizes,
+	     uint64_t const *seeds,
+	     size_t n_seeds,
+	     double const *escape_factors,
+	     size_t n_escape_factors,
+	     char const *path)
+{
+  size_t const n_jobs = n_sizes * n_seeds * n_escape_factors;
+  unsigned const n_workers = config->workers > 0 ? config->workers : 1;
+  EnsembleJob *jobs = (EnsembleJob *)malloc(n_jobs * sizeof(EnsembleJob));
+  char *finished = (char *)malloc(n_jobs * KEY_SIZE);
+  size_t n_finished = n_jobs, n_todo = 0;
+  char key[KEY_SIZE];
+  Worker *workers;
+  Pool pool;
+  long valid;
+
+  /* Lines of an earlier, interrupted run are kept up to the last whole one. */
+  valid = read_finished(path, &finished, &n_finished);
+  if ((valid > 0 && truncate(path, valid) < 0) ||
+      !(pool.out = fopen(path, valid > 0 ? "a" : "w"))) {
+    perror(path);
+    free(finished);
+    free(jobs);
+    return -1;
+  }
+  if (valid == 0) {
+    fputs(header, pool.out);
+    fflush(pool.out);
+  }
+  qsort(finished, n_finished, KEY_SIZE, compare_keys);
+
+  for (size_t i = 0; i < n_sizes; ++i) {
+    for (size_t j = 0; j < n_seeds; ++j) {
+      for (size_t k = 0; k < n_escape_factors; ++k) {
+	EnsembleJob const job = { sizes[i], seeds[j], escape_factors[k] };
+	job_key(config, &job, key);
+	if (!bsearch(key, finished, n_finished, KEY_SIZE, compare_keys)) {
+	  jobs[n_todo++] = job;
+	}
+      }
+    }
+  }
+  free(finished);
+  fprintf(stderr, "ensemble: %zu of %zu crystals to grow on %u workers\n",
+	  n_todo, n_jobs, n_workers);
+
+  /* Largest crystals first, dealt round robin, so the queues start even. */
+  qsort(jobs, n_todo, sizeof(EnsembleJob), compare_sizes);
+  pool.config = config;
+  pool.done = 0;
+  pool.total = n_todo;
+  pthread_mutex_init(&pool.out_lock, NULL);
+  pool.queues = (JobQueue *)calloc(n_workers, sizeof(JobQueue));
+  for (unsigned w = 0; w < n_workers; ++w) {
+    JobQueue *q = &pool.queues[w];
+    pthread_mutex_init(&q->lock, NULL);
+    q->jobs = (EnsembleJob *)malloc((n_todo / n_workers + 1) * sizeof(EnsembleJob));
+    for (size_t i = w; i < n_todo; i += n_workers) {
+      q->jobs[q->tail++] = jobs[i];
+    }
+  }
+  free(jobs);
+
+  workers = (Worker *)calloc(n_workers, sizeof(Worker));
+  for (unsigned w = 0; w < n_workers; ++w) {
+    workers[w].pool = &pool;
+    workers[w].id = w;
+    pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]);
+  }
+  for (unsigned w = 0; w < n_workers; ++w) {
+    pthread_join(workers[w].thread, NULL);
+    pthread_mutex_destroy(&pool.queues[w].lock);
+    free(pool.queues[w].jobs);
+  }
+  free(workers);
+  free(pool.queues);
+  pthread_mutex_destroy(&pool.out_lock);
+  return fclose(pool.out) ? -1 : 0;
+}
+
+/*
+ * The bath is only replaced when a job needs a larger one, smaller
+ * crystals grow in the middle of the current bath.
+ */
+static void *
+worker_main(void *arg)
+{
+  Worker *wk = (Worker *)arg;
+  Pool *pool = wk->pool;
+  EnsembleConfig const *config = pool->config;
+  Matrix *bath = NULL;
+  CrystalModel *cm = NULL;
+  EnsembleJob job;
+  ClusterStats cluster;
+  char key[KEY_SIZE], line[LINE_SIZE];
+  double t0, seconds;
+
+  while (take_job(pool, wk->id, &job)) {
+    unsigned const r_start = job.size/2;
+    unsigned const r_escape = (unsigned)(job.escape_factor * r_start);
+    unsigned const width = 2 * (r_escape + 2);
+
+    if (!bath || Matrix_size(bath) < width) {
+      CrystalModel_destroy(cm);
+      Matrix_destroy(bath);
+      bath = Matrix_create_with_layout(width, config->layout);
+      cm = CrystalModel_create(bath, r_start, r_escape);
+      CrystalModel_set_long_jumps(cm, config->long_jumps);
+      CrystalModel_set_launch_mode(cm, config->launch_mode);
+      CrystalModel_set_escape_mode(cm, config->escape_mode);
+      CrystalModel_set_kernel(cm, config->kernel);
+      if (config->lattice != CRYSTAL_LATTICE_SQUARE) {
+	CrystalModel_set_lattice(cm, config->lattice);
+      }
+      if (config->rule != CRYSTAL_RULE_DLA) {
+	CrystalModel_set_rule(cm, config->rule, config->rule_param);
+      }
+    } else {
+      CrystalModel_set_radii(cm, r_start, r_escape);
+    }
+    CrystalModel_srand(cm, job.seed);
+    t0 = crystal_time();
+    CrystalModel_run_some_steps(cm, UINT_MAX);
+
+    seconds = crystal_time() - t0;
+
+    job_key(config, &job, key);
+    CrystalModel_get_cluster_stats(cm, &cluster);
+    snprintf(line, sizeof(line), "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%u,%.3f,%.4f,%.6f\n",
+	     key, CrystalModel_get_ions(cm), CrystalModel_get_steps(cm),
+	     CrystalModel_get_escapes(cm), CrystalModel_get_crystal_radius(cm),
+	     cluster.rg, cluster.fractal_dimension, seconds);
+    pthread_mutex_lock(&pool->out_lock);
+    fputs(line, pool->out);
+    fflush(pool->out);
+    pool->done++;
+    fprintf(stderr, "ensemble: %zu/%zu size %zu seed %" PRIu64 "\n",
+	    pool->done, pool->total, job.size, job.seed);
+    pthread_mutex_unlock(&pool->out_lock);
+  }
+  CrystalModel_destroy(cm);
+  Matrix_destroy(bath);
+  return NULL;
+}
+
+/* Takes the next own job, or steals the last one of another worker. */
+static int
+take_job(Pool *pool,
+	 unsigned id,
+	 EnsembleJob *job)
+{
+  unsigned const n = pool->config->workers > 0 ? pool->config->workers : 1;
+
+  for (unsigned k = 0; k < n; ++k) {
+    JobQueue *q = &pool->queues[(id + k) % n];
+    int found = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+      *job = k == 0 ? q->jobs[q->head++] : q->jobs[--q->tail];
+      found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (found) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* The parameter of the sticky and noise rules is part of the rule, as in rule=sticky:0.5 */
+static void
+job_key(EnsembleConfig const *config,
+	EnsembleJob const *job,
+	char *key)
+{
+  int const n = snprintf(key, KEY_SIZE, "%zu,%" PRIu64 ",%g,%s,%s", job->size, job->seed,
+			 job->escape_factor, lattice_names[config->lattice],
+			 rule_names[config->rule]);
+  if (config->rule == CRYSTAL_RULE_STICKY || config->rule == CRYSTAL_RULE_NOISE) {
+    snprintf(key + n, KEY_SIZE - n, ":%g", config->rule_param);
+  }
+}
+
+static int
+compare_keys(void const *a,
+	     void const *b)
+{
+  return strcmp((char const *)a, (char const *)b);
+}
+
+static int
+compare_sizes(void const *a,
+	      void const *b)
+{
+  size_t const x = ((EnsembleJob const *)a)->size, y = ((EnsembleJob const *)b)->size;
+  return (x < y) - (x > y);
+}
+
+/*
+ * Collects the keys of the crystals listed in `path` into *keys, which
+ * holds up to *n_keys of them, and returns the length of the file up to
+ * its last complete line, 0 if there is none yet.
+ */
+static long
+read_finished(char const *path,
+	      char **keys,
+	      size_t *n_keys)
+{
+  FILE *in = fopen(path, "r");
+  size_t capacity = *n_keys;
+  char line[LINE_SIZE];
+  long valid = 0;
+
+  *n_keys = 0;
+  if (!in) {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), in) && strchr(line, '\n')) {
+    char *end = line;
+    valid = ftell(in);
+    for (int commas = 0; *end && commas < KEY_FIELDS; ++end) {
+      commas += *end == ',';
+    }
+    if (strcmp(line, header) == 0 || end[-1] != ',' || end - line > KEY_SIZE) {
+      continue;
+    }
+    end[-1] = '\0';
+    if (*n_keys == capacity) {
+      capacity = 2 * capacity + 1;
+      *keys = (char *)realloc(*keys, capacity * KEY_SIZE);
+    }
+    memcpy(*keys + *n_keys * KEY_SIZE, line, end - line);
+    ++*n_keys;
+  }
+  fclose(in);
+  return valid;
+}
@@ -0,0 +1,50 @@
+#ifndef ENSEMBLE_H_
+#define ENSEMBLE_H_
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "CrystalModel.h"
+#include "Matrix.h"
+
+/* One crystal of an ensemble. */
+typedef struct
+{
+  size_t size;          /* r_start is size/2, as in mode=cli */
+  uint64_t seed;
+  double escape_factor; /* r_escape over r_start */
+} EnsembleJob;
+
+/* Settings shared by all crystals of an ensemble. */
+typedef struct
+{
+  int long_jumps;
+  CrystalLaunchMode launch_mode;
+  CrystalEscapeMode escape_mode;
+  CrystalKernel kernel;
+  CrystalLattice lattice;
+  CrystalRule rule;
+  double rule_param;    /* as for CrystalModel_set_rule */
+  MatrixLayout layout;
+  unsigned workers;
+} EnsembleConfig;
+
+/*
+ * Grows every job of the grid sizes x seeds x escape factors on a pool
+ * of `config->workers` threads that steal jobs from each other. Every
+ * worker reuses one model and bath across its jobs. One CSV line per
+ * crystal is appended to `path` as soon as it is done. Jobs already
+ * listed in `path` with the same lattice and rule are skipped, so an
+ * interrupted ensemble continues where it stopped. Returns 0 on success, -1 on error.
+ */
+extern int
+Ensemble_run(EnsembleConfig const *config,
+	     size_t const *sizes,
+	     size_t n_sizes,
+	     uint64_t const *seeds,
+	     size_t n_seeds,
+	     double const *escape_factors,
+	     size_t n_escape_factors,
+	     char const *path);
+
+#endif //ENSEMBLE_H_
@@ -3,13 +3,62 @@
 #include <stdlib.h>
 #include <string.h>
 
+matrix_t const matrix_zero_tile[MATRIX_TILE_CELLS];
+
+static size_t
+cells(Matrix const *self)
+{
+  return (size_t)self->_stride * (self->_layout == MATRIX_LAYOUT_BITS ?
+				  self->_size : self->_stride);
+}
+
 extern Matrix *
 Matrix_create(unsigned size)
+{
+  return Matrix_create_with_layout(size, MATRIX_LAYOUT_BYTES);
+}
+
+extern Matrix *
+Matrix_create_with_layout(unsigned size,
+			  MatrixLayout layout)
 {
   Matrix *self = (Matrix *)calloc(1, sizeof(Matrix));
+  size_t chunks;
   
-  self->_array = (matrix_t *)calloc(size*size, sizeof(matrix_t));
   self->_size = size;
+  self->_layout = layout;
+  switch (layout) {
+  case MATRIX_LAYOUT_BITS:
+    /* Rows are padded to whole words, plus one spare word at the end so
+       that 32-bit gathers at the last cell stay inside the plane. */
+    self->_stride = (size + 63) & ~63u;
+    self->_bits = (uint64_t *)calloc(cells(self)/64 + 1, sizeof(uint64_t));
+    self->_halo = (uint64_t *)calloc(cells(self)/64 + 1, sizeof(uint64_t));
+    break;
+  case MATRIX_LAYOUT_TILED:
+  case MATRIX_LAYOUT_SPARSE:
+    self->_tiles_per_row = (size + MATRIX_TILE_MASK) >> MATRIX_TILE_SHIFT;
+    self->_stride = self->_tiles_per_row << MATRIX_TILE_SHIFT;
+    if (layout == MATRIX_LAYOUT_TILED) {
+      self->_array = (matrix_t *)calloc(cells(self), sizeof(matrix_t));
+    } else {
+      self->_chunks_per_row = (self->_tiles_per_row + MATRIX_CHUNK_MASK) >> MATRIX_CHUNK_SHIFT;
+      chunks = (size_t)self->_chunks_per_row * self->_chunks_per_row;
+      self->_zero_chunk = (matrix_t const **)malloc(MATRIX_CHUNK_TILES * sizeof(matrix_t const *));
+      for (unsigned t = 0; t < MATRIX_CHUNK_TILES; ++t) {
+	self->_zero_chunk[t] = matrix_zero_tile;
+      }
+      self->_chunks = (matrix_t const ***)malloc(chunks * sizeof(matrix_t const **));
+      for (size_t c = 0; c < chunks; ++c) {
+	self->_chunks[c] = self->_zero_chunk;
+      }
+    }
+    break;
+  default:
+    self->_stride = size;
+    self->_array = (matrix_t *)calloc(cells(self), sizeof(matrix_t));
+    break;
+  }
   
   return self;
 }
@@ -19,12 +68,84 @@ Matrix_destroy(Matrix *self)
 {
   if (!self) { return; }
 
+  if (self->_chunks) {
+    Matrix_clear(self);
+    free(self->_chunks); self->_chunks = NULL;
+    free(self->_zero_chunk); self->_zero_chunk = NULL;
+  }
   free(self->_array); self->_array = NULL;
+  free(self->_bits); self->_bits = NULL;
+  free(self->_halo); self->_halo = NULL;
   free(self);
 }
 
 extern void
 Matrix_clear(Matrix *self)
 {
-  memset(self->_array, 0, self->_size*self->_size);
+  size_t chunks;
+  switch (self->_layout) {
+  case MATRIX_LAYOUT_BITS:
+    memset(self->_bits, 0, (cells(self)/64 + 1) * sizeof(uint64_t));
+    memset(self->_halo, 0, (cells(self)/64 + 1) * sizeof(uint64_t));
+    break;
+  case MATRIX_LAYOUT_SPARSE:
+    /* Give the memory back, the next run may grow elsewhere. */
+    chunks = (size_t)self->_chunks_per_row * self->_chunks_per_row;
+    for (size_t c = 0; c < chunks; ++c) {
+      if (self->_chunks[c] == self->_zero_chunk) {
+	continue;
+      }
+      for (unsigned t = 0; t < MATRIX_CHUNK_TILES; ++t) {
+	if (self->_chunks[c][t] != matrix_zero_tile) {
+	  free((matrix_t *)self->_chunks[c][t]);
+	}
+      }
+      free(self->_chunks[c]);
+      self->_chunks[c] = self->_zero_chunk;
+    }
+    self->_tiles_allocated = 0;
+    self->_chunks_allocated = 0;
+    break;
+  default:
+    memset(self->_array, 0, cells(self));
+    break;
+  }
+}
+
+extern size_t
+Matrix_allocated_bytes(Matrix const *self)
+{
+  switch (self->_layout) {
+  case MATRIX_LAYOUT_BITS:
+    return 2 * (cells(self)/64 + 1) * sizeof(uint64_t);
+  case MATRIX_LAYOUT_SPARSE:
+    return self->_tiles_allocated * MATRIX_TILE_CELLS +
+      (self->_chunks_allocated + 1) * MATRIX_CHUNK_TILES * sizeof(matrix_t const *) +
+      (size_t)self->_chunks_per_row * self->_chunks_per_row * sizeof(matrix_t const **);
+  default:
+    return cells(self);
+  }
+}
+
+extern matrix_t *
+Matrix_allocate_tile(Matrix *self,
+		     unsigned x,
+		     unsigned y)
+{
+  unsigned const tx = x >> MATRIX_TILE_SHIFT, ty = y >> MATRIX_TILE_SHIFT;
+  size_t const c = (tx >> MATRIX_CHUNK_SHIFT) + (ty >> MATRIX_CHUNK_SHIFT)*self->_chunks_per_row;
+  matrix_t *tile;
+
+  /* Published with release stores for Matrix_get_shared. */
+  if (self->_chunks[c] == self->_zero_chunk) {
+    matrix_t const **chunk =
+      (matrix_t const **)malloc(MATRIX_CHUNK_TILES * sizeof(matrix_t const *));
+    memcpy(chunk, self->_zero_chunk, MATRIX_CHUNK_TILES * sizeof(matrix_t const *));
+    __atomic_store_n(&self->_chunks[c], chunk, __ATOMIC_RELEASE);
+    self->_chunks_allocated++;
+  }
+  tile = (matrix_t *)calloc(MATRIX_TILE_CELLS, sizeof(matrix_t));
+  __atomic_store_n(Matrix_sparse_tile(self, x, y), tile, __ATOMIC_RELEASE);
+  self->_tiles_allocated++;
+  return tile;
 }
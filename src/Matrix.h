@@ -1,42 +1,271 @@
 #ifndef MATRIX_H_
 #define MATRIX_H_
 
+#include <inttypes.h>
+#include <stddef.h>
+
 typedef unsigned char matrix_t;
 
+typedef enum
+{
+  MATRIX_LAYOUT_BYTES, /* one matrix_t per cell, row-major */
+  MATRIX_LAYOUT_BITS,  /* one bit per cell plus a halo bit plane */
+  MATRIX_LAYOUT_TILED, /* one matrix_t per cell, row-major tiles */
+  MATRIX_LAYOUT_SPARSE /* tiles allocated on first write */
+} MatrixLayout;
+
+/* Tiled layouts store 2^TILE_SHIFT x 2^TILE_SHIFT tiles of one page. */
+#define MATRIX_TILE_SHIFT 6
+#define MATRIX_TILE_MASK ((1u << MATRIX_TILE_SHIFT) - 1)
+#define MATRIX_TILE_CELLS (1u << 2*MATRIX_TILE_SHIFT)
+
+/*
+ * Sparse matrices find their tiles through a two level directory, each
+ * chunk of it covering 2^CHUNK_SHIFT x 2^CHUNK_SHIFT tiles. Tiles and
+ * chunks that were never written point to shared zeros, so reading
+ * untouched space never allocates. The top level is allocated in full,
+ * one pointer per 4096 x 4096 cells: 2 MB for a matrix of size 2^21,
+ * growing with the square of the size beyond.
+ */
+#define MATRIX_CHUNK_SHIFT 6
+#define MATRIX_CHUNK_MASK ((1u << MATRIX_CHUNK_SHIFT) - 1)
+#define MATRIX_CHUNK_TILES (1u << 2*MATRIX_CHUNK_SHIFT)
+
+extern matrix_t const matrix_zero_tile[MATRIX_TILE_CELLS];
+
 typedef struct {
   matrix_t *_array;
+  uint64_t *_bits;
+  uint64_t *_halo;
+  matrix_t const ***_chunks;
+  matrix_t const **_zero_chunk;
+  size_t _tiles_allocated;
+  size_t _chunks_allocated;
+  unsigned _chunks_per_row;
   unsigned _size;
+  unsigned _stride;
+  unsigned _tiles_per_row;
+  MatrixLayout _layout;
 } Matrix;
 
 extern Matrix *
 Matrix_create(unsigned size);
 
+extern Matrix *
+Matrix_create_with_layout(unsigned size,
+			  MatrixLayout layout);
+
 extern void
 Matrix_destroy(Matrix *self);
 
 extern void
 Matrix_clear(Matrix *self);
 
+/* Bytes of cell storage currently allocated. */
+extern size_t
+Matrix_allocated_bytes(Matrix const *self);
+
+extern matrix_t *
+Matrix_allocate_tile(Matrix *self,
+		     unsigned x,
+		     unsigned y);
+
 static inline unsigned
-Matrix_size(Matrix *self)
+Matrix_size(Matrix const *self)
 {
   return self->_size;
 }
 
+static inline MatrixLayout
+Matrix_layout(Matrix const *self)
+{
+  return self->_layout;
+}
+
+/* Cells between the starts of two consecutive rows, except when tiled. */
+static inline unsigned
+Matrix_stride(Matrix const *self)
+{
+  return self->_stride;
+}
+
+/* Position of a cell in the storage of the matrix, except when sparse. */
+static inline size_t
+Matrix_index(Matrix const *self,
+	     unsigned x,
+	     unsigned y)
+{
+  if (self->_layout == MATRIX_LAYOUT_TILED) {
+    size_t const tile = (x >> MATRIX_TILE_SHIFT) +
+      (size_t)(y >> MATRIX_TILE_SHIFT)*self->_tiles_per_row;
+    return ((tile << MATRIX_TILE_SHIFT | (y & MATRIX_TILE_MASK)) << MATRIX_TILE_SHIFT |
+	    (x & MATRIX_TILE_MASK));
+  }
+  return x + (size_t)y*self->_stride;
+}
+
+/* Not valid for MATRIX_LAYOUT_BITS and MATRIX_LAYOUT_SPARSE. */
 static inline matrix_t *
 Matrix_at(Matrix *self,
 	  unsigned x,
 	  unsigned y)
 {
-  return self->_array + (x + y*self->_size);
+  return self->_array + Matrix_index(self, x, y);
 }
 
+/* Not valid for MATRIX_LAYOUT_BITS and MATRIX_LAYOUT_SPARSE. */
 static inline matrix_t const *
 Matrix_at_const(Matrix const *self,
 		unsigned x,
 		unsigned y)
 {
-  return self->_array + (x + y*self->_size);
+  return self->_array + Matrix_index(self, x, y);
+}
+
+static inline matrix_t const **
+Matrix_sparse_tile(Matrix const *self,
+		   unsigned x,
+		   unsigned y)
+{
+  unsigned const tx = x >> MATRIX_TILE_SHIFT, ty = y >> MATRIX_TILE_SHIFT;
+  matrix_t const **chunk = self->_chunks[(tx >> MATRIX_CHUNK_SHIFT) +
+					 (ty >> MATRIX_CHUNK_SHIFT)*self->_chunks_per_row];
+  return &chunk[(ty & MATRIX_CHUNK_MASK) << MATRIX_CHUNK_SHIFT | (tx & MATRIX_CHUNK_MASK)];
+}
+
+static inline unsigned
+Matrix_sparse_cell(unsigned x,
+		   unsigned y)
+{
+  return (y & MATRIX_TILE_MASK) << MATRIX_TILE_SHIFT | (x & MATRIX_TILE_MASK);
+}
+
+static inline matrix_t
+Matrix_get(Matrix const *self,
+	   unsigned x,
+	   unsigned y)
+{
+  size_t i;
+  switch (self->_layout) {
+  case MATRIX_LAYOUT_SPARSE:
+    return (*Matrix_sparse_tile(self, x, y))[Matrix_sparse_cell(x, y)];
+  case MATRIX_LAYOUT_BITS:
+    i = Matrix_index(self, x, y);
+    return (self->_bits[i >> 6] >> (i & 63)) & 1;
+  default:
+    return self->_array[Matrix_index(self, x, y)];
+  }
+}
+
+/*
+ * Matrix_get for threads that read while one other thread sets cells:
+ * every load is atomic, and a new tile of MATRIX_LAYOUT_SPARSE is only
+ * seen together with its zeros.
+ */
+static inline matrix_t
+Matrix_get_shared(Matrix const *self,
+		  unsigned x,
+		  unsigned y)
+{
+  unsigned const tx = x >> MATRIX_TILE_SHIFT, ty = y >> MATRIX_TILE_SHIFT;
+  matrix_t const **chunk;
+  matrix_t const *tile;
+  size_t i;
+  switch (self->_layout) {
+  case MATRIX_LAYOUT_SPARSE:
+    chunk = __atomic_load_n(&self->_chunks[(tx >> MATRIX_CHUNK_SHIFT) +
+					   (ty >> MATRIX_CHUNK_SHIFT)*self->_chunks_per_row],
+			    __ATOMIC_ACQUIRE);
+    tile = __atomic_load_n(&chunk[(ty & MATRIX_CHUNK_MASK) << MATRIX_CHUNK_SHIFT |
+				  (tx & MATRIX_CHUNK_MASK)], __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&tile[Matrix_sparse_cell(x, y)], __ATOMIC_RELAXED);
+  case MATRIX_LAYOUT_BITS:
+    i = Matrix_index(self, x, y);
+    return (__atomic_load_n(&self->_bits[i >> 6], __ATOMIC_RELAXED) >> (i & 63)) & 1;
+  default:
+    return __atomic_load_n(&self->_array[Matrix_index(self, x, y)], __ATOMIC_RELAXED);
+  }
+}
+
+/*
+ * In MATRIX_LAYOUT_BITS any non-zero value is stored as 1. In
+ * MATRIX_LAYOUT_SPARSE the first non-zero value of a tile allocates it.
+ * Stores are atomic, so other threads may read with Matrix_get_shared
+ * meanwhile.
+ */
+static inline void
+Matrix_set(Matrix *self,
+	   unsigned x,
+	   unsigned y,
+	   matrix_t value)
+{
+  size_t i;
+  matrix_t *tile;
+  uint64_t *word;
+  switch (self->_layout) {
+  case MATRIX_LAYOUT_BITS:
+    i = Matrix_index(self, x, y);
+    word = &self->_bits[i >> 6];
+    if (value) {
+      __atomic_store_n(word, *word | UINT64_C(1) << (i & 63), __ATOMIC_RELAXED);
+    } else {
+      __atomic_store_n(word, *word & ~(UINT64_C(1) << (i & 63)), __ATOMIC_RELAXED);
+    }
+    break;
+  case MATRIX_LAYOUT_SPARSE:
+    tile = (matrix_t *)*Matrix_sparse_tile(self, x, y);
+    if (tile == matrix_zero_tile) {
+      if (!value) {
+	break;
+      }
+      tile = Matrix_allocate_tile(self, x, y);
+    }
+    __atomic_store_n(&tile[Matrix_sparse_cell(x, y)], value, __ATOMIC_RELAXED);
+    break;
+  default:
+    __atomic_store_n(&self->_array[Matrix_index(self, x, y)], value, __ATOMIC_RELAXED);
+    break;
+  }
+}
+
+/*
+ * The halo plane is a second bit plane of MATRIX_LAYOUT_BITS that users
+ * set for every cell next to an occupied one, turning a neighbour test
+ * into a single bit load.
+ */
+static inline int
+Matrix_has_halo(Matrix const *self)
+{
+  return self->_halo != 0;
+}
+
+static inline int
+Matrix_get_halo(Matrix const *self,
+		unsigned x,
+		unsigned y)
+{
+  size_t const i = Matrix_index(self, x, y);
+  return (self->_halo[i >> 6] >> (i & 63)) & 1;
+}
+
+/* Matrix_get_halo against a concurrent Matrix_set_halo. */
+static inline int
+Matrix_get_halo_shared(Matrix const *self,
+		       unsigned x,
+		       unsigned y)
+{
+  size_t const i = Matrix_index(self, x, y);
+  return (__atomic_load_n(&self->_halo[i >> 6], __ATOMIC_RELAXED) >> (i & 63)) & 1;
+}
+
+static inline void
+Matrix_set_halo(Matrix *self,
+		unsigned x,
+		unsigned y)
+{
+  size_t const i = Matrix_index(self, x, y);
+  __atomic_store_n(&self->_halo[i >> 6], self->_halo[i >> 6] | UINT64_C(1) << (i & 63),
+		   __ATOMIC_RELAXED);
 }
 
 #endif /* MATRIX_H_ */
@@ -0,0 +1,69 @@
+#include "Volume.h"
+
+#include <stdlib.h>
+
+uint64_t const volume_zero_page[VOLUME_PAGE_BRICKS];
+
+static size_t
+pages(Volume const *self);
+
+extern Volume *
+Volume_create(unsigned size)
+{
+  Volume *self = (Volume *)calloc(1, sizeof(Volume));
+
+  self->_size = size;
+  self->_pages_per_row = (size + VOLUME_PAGE_SIDE - 1) / VOLUME_PAGE_SIDE;
+  self->_pages = (uint64_t const **)malloc(pages(self) * sizeof(uint64_t const *));
+  for (size_t p = 0; p < pages(self); ++p) {
+    self->_pages[p] = volume_zero_page;
+  }
+  return self;
+}
+
+extern void
+Volume_destroy(Volume *self)
+{
+  if (!self) { return; }
+
+  Volume_clear(self);
+  free(self->_pages); self->_pages = NULL;
+  free(self);
+}
+
+extern void
+Volume_clear(Volume *self)
+{
+  for (size_t p = 0; p < pages(self); ++p) {
+    if (self->_pages[p] != volume_zero_page) {
+      free((uint64_t *)self->_pages[p]);
+      self->_pages[p] = volume_zero_page;
+    }
+  }
+  self->_pages_allocated = 0;
+}
+
+extern size_t
+Volume_allocated_bytes(Volume const *self)
+{
+  return (self->_pages_allocated * VOLUME_PAGE_BRICKS * sizeof(uint64_t) +
+	  pages(self) * sizeof(uint64_t const *));
+}
+
+extern uint64_t *
+Volume_allocate_page(Volume *self,
+		     unsigned x,
+		     unsigned y,
+		     unsigned z)
+{
+  uint64_t *page = (uint64_t *)calloc(VOLUME_PAGE_BRICKS, sizeof(uint64_t));
+  *Volume_page(self, x, y, z) = page;
+  self->_pages_allocated++;
+  return page;
+}
+
+static size_t
+pages(Volume const *self)
+{
+  return (size_t)self->_pages_per_row * self->_pages_per_row * self->_pages_per_row;
+}
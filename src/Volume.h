@@ -0,0 +1,120 @@
+#ifndef VOLUME_H_
+#define VOLUME_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * Cubic lattice of one bit per voxel. Voxels are packed in bricks of
+ * 2^BRICK_SHIFT voxels along each axis, one 64-bit word per brick, and
+ * bricks in pages of 2^PAGE_SHIFT bricks along each axis. Pages are
+ * allocated on the first write; the others point to shared zeros, so
+ * memory follows the part of the volume that holds voxels.
+ */
+#define VOLUME_BRICK_SHIFT 2
+#define VOLUME_BRICK_MASK ((1u << VOLUME_BRICK_SHIFT) - 1)
+#define VOLUME_PAGE_SHIFT 4
+#define VOLUME_PAGE_MASK ((1u << VOLUME_PAGE_SHIFT) - 1)
+#define VOLUME_PAGE_BRICKS (1u << 3*VOLUME_PAGE_SHIFT)
+/* Voxels along each axis of a page. */
+#define VOLUME_PAGE_SIDE (1u << (VOLUME_BRICK_SHIFT + VOLUME_PAGE_SHIFT))
+
+extern uint64_t const volume_zero_page[VOLUME_PAGE_BRICKS];
+
+typedef struct {
+  uint64_t const **_pages;
+  size_t _pages_allocated;
+  unsigned _pages_per_row;
+  unsigned _size;
+} Volume;
+
+/* A volume of size^3 voxels, all empty. */
+extern Volume *
+Volume_create(unsigned size);
+
+extern void
+Volume_destroy(Volume *self);
+
+extern void
+Volume_clear(Volume *self);
+
+/* Bytes of voxel storage currently allocated. */
+extern size_t
+Volume_allocated_bytes(Volume const *self);
+
+extern uint64_t *
+Volume_allocate_page(Volume *self,
+		     unsigned x,
+		     unsigned y,
+		     unsigned z);
+
+static inline unsigned
+Volume_size(Volume const *self)
+{
+  return self->_size;
+}
+
+static inline uint64_t const **
+Volume_page(Volume const *self,
+	    unsigned x,
+	    unsigned y,
+	    unsigned z)
+{
+  unsigned const shift = VOLUME_BRICK_SHIFT + VOLUME_PAGE_SHIFT;
+  return &self->_pages[((size_t)(z >> shift) * self->_pages_per_row + (y >> shift)) *
+		       self->_pages_per_row + (x >> shift)];
+}
+
+static inline unsigned
+Volume_brick_index(unsigned x,
+		   unsigned y,
+		   unsigned z)
+{
+  return ((((z >> VOLUME_BRICK_SHIFT) & VOLUME_PAGE_MASK) << VOLUME_PAGE_SHIFT |
+	   ((y >> VOLUME_BRICK_SHIFT) & VOLUME_PAGE_MASK)) << VOLUME_PAGE_SHIFT |
+	  ((x >> VOLUME_BRICK_SHIFT) & VOLUME_PAGE_MASK));
+}
+
+static inline unsigned
+Volume_voxel_bit(unsigned x,
+		 unsigned y,
+		 unsigned z)
+{
+  return (((z & VOLUME_BRICK_MASK) << VOLUME_BRICK_SHIFT |
+	   (y & VOLUME_BRICK_MASK)) << VOLUME_BRICK_SHIFT |
+	  (x & VOLUME_BRICK_MASK));
+}
+
+/* The brick holding voxel (x, y, z), bit Volume_voxel_bit of it. */
+static inline uint64_t
+Volume_brick(Volume const *self,
+	     unsigned x,
+	     unsigned y,
+	     unsigned z)
+{
+  return (*Volume_page(self, x, y, z))[Volume_brick_index(x, y, z)];
+}
+
+static inline int
+Volume_get(Volume const *self,
+	   unsigned x,
+	   unsigned y,
+	   unsigned z)
+{
+  return (Volume_brick(self, x, y, z) >> Volume_voxel_bit(x, y, z)) & 1;
+}
+
+static inline void
+Volume_set(Volume *self,
+	   unsigned x,
+	   unsigned y,
+	   unsigned z)
+{
+  uint64_t *page = (uint64_t *)*Volume_page(self, x, y, z);
+  if (page == volume_zero_page) {
+    page = Volume_allocate_page(self, x, y, z);
+  }
+  page[Volume_brick_index(x, y, z)] |= UINT64_C(1) << Volume_voxel_bit(x, y, z);
+}
+
+#endif /* VOLUME_H_ */
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "Benchmark.h"
+
+/* Headless entry point of the CCrystalSimulation_bench target. */
+
+#define MAX_SIZES 32
+
+static size_t
+parse_sizes(char const *list,
+	    size_t *sizes)
+{
+  size_t n = 0;
+  char *end;
+
+  while (n < MAX_SIZES && *list) {
+    sizes[n] = strtoul(list, &end, 10);
+    if (end == list) {
+      break;
+    }
+    if (sizes[n] >= 20) {
+      n++;
+    }
+    list = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+int
+main(int argc,
+     char *argv[])
+{
+  size_t sizes[MAX_SIZES] = { 100, 200, 400, 800 };
+  size_t n_sizes = 4;
+  unsigned repetitions = 5;
+  uint64_t seed = 1;
+  BenchmarkFormat format = BENCHMARK_JSON;
+  BenchmarkConfig config; memset(&config, 0, sizeof(config));
+  FILE *out = stdout;
+  int ret;
+
+  config.threads = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "sizes=", 6) == 0) {
+      n_sizes = parse_sizes(argv[i] + 6, sizes);
+    } else if (strncmp(argv[i], "reps=", 5) == 0) {
+      repetitions = atoi(argv[i] + 5);
+    } else if (strncmp(argv[i], "seed=", 5) == 0) {
+      seed = strtoull(argv[i] + 5, NULL, 10);
+    } else if (strncmp(argv[i], "format=", 7) == 0) {
+      format = (strcmp("csv", argv[i] + 7) == 0 ? BENCHMARK_CSV :
+		strcmp("text", argv[i] + 7) == 0 ? BENCHMARK_TEXT : BENCHMARK_JSON);
+    } else if (strncmp(argv[i], "output=", 7) == 0) {
+      if (!(out = fopen(argv[i] + 7, "w"))) {
+	perror(argv[i] + 7);
+	return EXIT_FAILURE;
+      }
+    } else if (strncmp(argv[i], "jumps=", 6) == 0) {
+      config.long_jumps = atoi(argv[i] + 6);
+    } else if (strncmp(argv[i], "launch=", 7) == 0) {
+      config.launch_mode = (strncmp("adaptive", argv[i] + 7, 8) == 0 ?
+			    CRYSTAL_LAUNCH_ADAPTIVE : CRYSTAL_LAUNCH_FIXED);
+    } else if (strncmp(argv[i], "escape=", 7) == 0) {
+      config.escape_mode = (strncmp("return", argv[i] + 7, 6) == 0 ?
+			    CRYSTAL_ESCAPE_RETURN : CRYSTAL_ESCAPE_RELAUNCH);
+    } else if (strncmp(argv[i], "kernel=", 7) == 0) {
+      config.kernel = (strncmp("batch", argv[i] + 7, 5) == 0 ? CRYSTAL_KERNEL_BATCH :
+		       strncmp("integer", argv[i] + 7, 7) == 0 ? CRYSTAL_KERNEL_INTEGER :
+		       CRYSTAL_KERNEL_SCALAR);
+    } else if (strncmp(argv[i], "threads=", 8) == 0) {
+      config.threads = atoi(argv[i] + 8);
+    } else if (strncmp(argv[i], "bath=", 5) == 0) {
+      if (strncmp("bits", argv[i] + 5, 4) == 0) {
+	config.layout = MATRIX_LAYOUT_BITS;
+      } else if (strncmp("tiled", argv[i] + 5, 5) == 0) {
+	config.layout = MATRIX_LAYOUT_TILED;
+      } else if (strncmp("sparse", argv[i] + 5, 6) == 0) {
+	config.layout = MATRIX_LAYOUT_SPARSE;
+      } else {
+	config.layout = MATRIX_LAYOUT_BYTES;
+      }
+    } else {
+      printf("usage: '%s sizes=[<value>,...] reps=[<value>] seed=[<value>] format=[json/csv/text] output=[<file>] jumps=[0/1] launch=[fixed/adaptive] escape=[relaunch/return] kernel=[scalar/batch/integer] threads=[<value>] bath=[bytes/bits/tiled/sparse]'\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (n_sizes == 0 || repetitions == 0) {
+    fprintf(stderr, "Nothing to run: give sizes of at least 20 and reps of at least 1\n");
+    return EXIT_FAILURE;
+  }
+
+  ret = Benchmark_growth(&config, sizes, n_sizes, repetitions, seed, format, out);
+  if (out != stdout) {
+    fclose(out);
+  }
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -5,40 +5,354 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include "Matrix.h"
 #include "CrystalModel.h"
+#include "CrystalModel3D.h"
 #include "CrystalView.h"
 #include "CrystalControl.h"
+#include "Benchmark.h"
+#include "Checkpoint.h"
+#include "CrystalWriter.h"
+#include "Ensemble.h"
 
 #include "root_directory.h" // This is a configuration file generated by CMake.
 
+/* Most sizes, seeds or escape factors of an ensemble. */
+#define MAX_ENSEMBLE_VALUES 1024
+
+typedef struct
+{
+  size_t size;
+  unsigned dim;
+  int long_jumps;
+  CrystalLaunchMode launch_mode;
+  int launch_given;     /* launch= was on the command line */
+  CrystalEscapeMode escape_mode;
+  CrystalKernel kernel;
+  CrystalLattice lattice;
+  CrystalRule rule;
+  double rule_param;
+  unsigned threads;
+  MatrixLayout layout;
+  char const *checkpoint;
+  unsigned checkpoint_ions;
+  unsigned checkpoint_secs;
+  char const *resume;
+  CrystalWriterFormat output_format;
+  char const *output;
+  unsigned frames;
+  size_t sizes[MAX_ENSEMBLE_VALUES];
+  size_t n_sizes;
+  uint64_t seeds[MAX_ENSEMBLE_VALUES];
+  size_t n_seeds;
+  double factors[MAX_ENSEMBLE_VALUES];
+  size_t n_factors;
+  char const *results;
+} SimOptions;
+
+static CrystalModel *
+create_model(SimOptions const *opts,
+	     Matrix **bath)
+{
+  unsigned m_r_start = opts->size/2;
+  unsigned m_r_escape = 11 * m_r_start / 10;
+  unsigned m_bath_width = 2 * (m_r_escape + 2);
+  CrystalModel *cm;
+
+  *bath = Matrix_create_with_layout(m_bath_width, opts->layout);
+  cm = CrystalModel_create(*bath, m_r_start, m_r_escape);
+  CrystalModel_set_long_jumps(cm, opts->long_jumps);
+  CrystalModel_set_launch_mode(cm, opts->launch_mode);
+  CrystalModel_set_escape_mode(cm, opts->escape_mode);
+  CrystalModel_set_kernel(cm, opts->kernel);
+  if (opts->lattice != CRYSTAL_LATTICE_SQUARE) {
+    CrystalModel_set_lattice(cm, opts->lattice);
+  }
+  if (opts->rule != CRYSTAL_RULE_DLA) {
+    CrystalModel_set_rule(cm, opts->rule, opts->rule_param);
+  }
+  return cm;
+}
+
+/* Comma separated values or ranges <first>-<last>, as in seeds=1-100,200 */
+static size_t
+parse_seeds(char const *list,
+	    uint64_t *seeds)
+{
+  size_t n = 0;
+  char *end;
+
+  while (n < MAX_ENSEMBLE_VALUES && *list) {
+    uint64_t first = strtoull(list, &end, 10), last = first;
+    if (end == list) {
+      break;
+    }
+    if (*end == '-') {
+      list = end + 1;
+      last = strtoull(list, &end, 10);
+    }
+    for (uint64_t s = first; s <= last && n < MAX_ENSEMBLE_VALUES; ++s) {
+      seeds[n++] = s;
+    }
+    list = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+static size_t
+parse_sizes(char const *list,
+	    size_t *sizes)
+{
+  size_t n = 0;
+  char *end;
+
+  while (n < MAX_ENSEMBLE_VALUES && *list) {
+    sizes[n] = strtoul(list, &end, 10);
+    if (end == list) {
+      break;
+    }
+    if (sizes[n] >= 20) {
+      n++;
+    }
+    list = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+static size_t
+parse_factors(char const *list,
+	      double *factors)
+{
+  size_t n = 0;
+  char *end;
+
+  while (n < MAX_ENSEMBLE_VALUES && *list) {
+    factors[n] = strtod(list, &end);
+    if (end == list) {
+      break;
+    }
+    if (factors[n] > 1.0) {
+      n++;
+    }
+    list = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+static int
+ensemble_sim(SimOptions const *opts)
+{
+  EnsembleConfig const config = {
+    opts->long_jumps, opts->launch_mode, opts->escape_mode, opts->kernel, opts->lattice,
+    opts->rule, opts->rule_param, opts->layout,
+    opts->threads > 0 ? opts->threads : sysconf(_SC_NPROCESSORS_ONLN)
+  };
+  size_t const default_size = opts->size;
+  uint64_t const default_seed = 0;
+  double const default_factor = 1.1;
+
+  if (!opts->results) {
+    fprintf(stderr, "mode=ensemble needs results=<file>\n");
+    return EXIT_FAILURE;
+  }
+  return Ensemble_run(&config,
+		      opts->n_sizes ? opts->sizes : &default_size,
+		      opts->n_sizes ? opts->n_sizes : 1,
+		      opts->n_seeds ? opts->seeds : &default_seed,
+		      opts->n_seeds ? opts->n_seeds : 1,
+		      opts->n_factors ? opts->factors : &default_factor,
+		      opts->n_factors ? opts->n_factors : 1,
+		      opts->results) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static void
 close_window_cb(void)
 {
   gtk_main_quit();
 }
 
+/*
+ * Writes `frames` pictures of the growth to <output>-0001.<ext> and so
+ * on, frame k showing the first k/frames of the ions.
+ */
 static int
-cli_sim(size_t size)
+write_frames(CrystalModel const *cm,
+	     SimOptions const *opts)
 {
-  unsigned m_r_start = size/2;
-  unsigned m_r_escape = 11 * m_r_start / 10;
-  unsigned m_bath_width = 2 * (m_r_escape + 2);
-  Matrix *bath = Matrix_create(m_bath_width);
-  CrystalModel *cm = CrystalModel_create(bath, m_r_start, m_r_escape);
-  while (CrystalModel_crystallize_one_ion(cm)) {
+  CrystalReplay *replay = CrystalReplay_create(cm);
+  char const *dot = strrchr(opts->output, '.');
+  int const stem = dot && !strchr(dot, '/') ? (int)(dot - opts->output) : (int)strlen(opts->output);
+  size_t const len = strlen(opts->output) + 16;
+  char *path = (char *)malloc(len);
+  uint64_t const ions = CrystalReplay_get_ions(replay);
+  int ret = EXIT_SUCCESS;
+  FILE *out;
+
+  for (unsigned k = 1; k <= opts->frames && ret == EXIT_SUCCESS; ++k) {
+    snprintf(path, len, "%.*s-%04u%s", stem, opts->output, k, opts->output + stem);
+    if (!(out = fopen(path, "wb"))) {
+      perror(path);
+      ret = EXIT_FAILURE;
+      break;
+    }
+    if (CrystalWriter_write_replay(cm, replay, (ions * k + opts->frames / 2) / opts->frames,
+				   opts->output_format, out)) {
+      fprintf(stderr, "Failed to write the crystal\n");
+      ret = EXIT_FAILURE;
+    }
+    if (fclose(out)) {
+      perror(path);
+      ret = EXIT_FAILURE;
+    }
+  }
+  free(path);
+  CrystalReplay_destroy(replay);
+  return ret;
+}
+
+static int
+cli_sim(SimOptions const *opts)
+{
+  Matrix *bath;
+  CrystalModel *cm = create_model(opts, &bath);
+  Checkpoint *cp;
+  CrystalStats stats;
+  ClusterStats cluster;
+  FILE *out = stdout;
+  int ret = EXIT_SUCCESS;
+
+  if (opts->resume && Checkpoint_resume(cm, opts->resume)) {
+    CrystalModel_destroy(cm);
+    Matrix_destroy(bath);
+    return EXIT_FAILURE;
+  }
+  if (opts->frames || opts->output_format == CRYSTAL_WRITER_AGE) {
+    /* Keeps the order of a resumed log, otherwise older ions come in raster order. */
+    CrystalModel_set_ion_log(cm, 1);
+  }
+  if (opts->checkpoint) {
+    cp = Checkpoint_create(opts->checkpoint, opts->checkpoint_ions,
+			   opts->checkpoint_ions || opts->checkpoint_secs ?
+			   opts->checkpoint_secs : 60);
+    /* A failed checkpoint is reported, the crystal is still written. */
+    if (Checkpoint_run(cp, cm, opts->threads)) {
+      ret = EXIT_FAILURE;
+    }
+    Checkpoint_destroy(cp);
+  } else {
+    CrystalModel_run_parallel(cm, UINT_MAX, opts->threads);
+  }
+  CrystalModel_get_stats(cm, &stats);
+  if (stats.enabled) {
+    CrystalStats_print(&stats, stderr);
+  }
+  CrystalModel_get_cluster_stats(cm, &cluster);
+  ClusterStats_print(&cluster, stderr);
+  if (opts->frames) {
+    if (write_frames(cm, opts) != EXIT_SUCCESS) {
+      ret = EXIT_FAILURE;
+    }
+  } else if (opts->output && !(out = fopen(opts->output, "wb"))) {
+    perror(opts->output);
+    ret = EXIT_FAILURE;
+  } else {
+    if (CrystalWriter_write(cm, opts->output_format, out)) {
+      fprintf(stderr, "Failed to write the crystal\n");
+      ret = EXIT_FAILURE;
+    }
+    if (out != stdout && fclose(out)) {
+      perror(opts->output);
+      ret = EXIT_FAILURE;
+    }
   }
-  printf("%s", CrystalModel_to_string(cm));
   CrystalModel_destroy(cm);
   Matrix_destroy(bath);
-  return EXIT_SUCCESS;
+  return ret;
+}
+
+/* The first option given that the three dimensional model has no counterpart for, or NULL. */
+static char const *
+unsupported_3d(SimOptions const *opts)
+{
+  if (opts->long_jumps) {
+    return "jumps=";
+  } else if (opts->launch_given && opts->launch_mode == CRYSTAL_LAUNCH_FIXED) {
+    /* The three dimensional radii always follow the crystal. */
+    return "launch=fixed";
+  } else if (opts->escape_mode != CRYSTAL_ESCAPE_RELAUNCH) {
+    return "escape=";
+  } else if (opts->kernel != CRYSTAL_KERNEL_SCALAR) {
+    return "kernel=";
+  } else if (opts->lattice != CRYSTAL_LATTICE_SQUARE) {
+    return "lattice=";
+  } else if (opts->rule != CRYSTAL_RULE_DLA) {
+    return "rule=";
+  } else if (opts->threads > 1) {
+    return "threads=";
+  } else if (opts->layout != MATRIX_LAYOUT_BYTES) {
+    return "bath=";
+  } else if (opts->checkpoint || opts->checkpoint_ions || opts->checkpoint_secs) {
+    return "checkpoint=";
+  } else if (opts->resume) {
+    return "resume=";
+  } else if (opts->frames) {
+    return "frames=";
+  } else if (opts->n_seeds) {
+    return "seeds=";
+  }
+  return NULL;
+}
+
+/* Command line runs in three dimensions, with the radii of create_model. */
+static int
+cli_sim_3d(SimOptions const *opts)
+{
+  unsigned const r_start = opts->size/2;
+  unsigned const r_escape = 11 * r_start / 10;
+  char const *option = unsupported_3d(opts);
+  Volume *vol;
+  CrystalModel3D *cm;
+  FILE *out = stdout;
+  int ret = EXIT_SUCCESS;
+
+  if (option) {
+    fprintf(stderr, "%s is not supported with dim=3\n", option);
+    return EXIT_FAILURE;
+  }
+  vol = Volume_create(2 * (r_escape + 2));
+  cm = CrystalModel3D_create(vol, r_start, r_escape);
+  while (CrystalModel3D_run_some_steps(cm, UINT_MAX)) {
+  }
+  fprintf(stderr, "ions %" PRIu64 ", voxels %" PRIu64 ", steps %" PRIu64 ", escapes %" PRIu64
+	  ", radius %u, %zu kB of volume\n",
+	  CrystalModel3D_get_ions(cm), CrystalModel3D_get_voxels(cm), CrystalModel3D_get_steps(cm),
+	  CrystalModel3D_get_escapes(cm), CrystalModel3D_get_crystal_radius(cm),
+	  Volume_allocated_bytes(vol) / 1024);
+  if (opts->output && !(out = fopen(opts->output, "wb"))) {
+    perror(opts->output);
+    ret = EXIT_FAILURE;
+  } else {
+    if (CrystalWriter_write_volume(cm, opts->output_format, out)) {
+      fprintf(stderr, "Failed to write the crystal\n");
+      ret = EXIT_FAILURE;
+    }
+    if (out != stdout && fclose(out)) {
+      perror(opts->output);
+      ret = EXIT_FAILURE;
+    }
+  }
+  CrystalModel3D_destroy(cm);
+  Volume_destroy(vol);
+  return ret;
 }
 
 static int
 gui_sim(int argc,
 	char *argv[],
-	size_t size)
+	SimOptions const *opts)
 {
   if (!gtk_init_check(&argc, &argv)) {
     fprintf(stderr, "Failed to init GTK. Exiting...\n");
@@ -46,13 +360,11 @@ gui_sim(int argc,
   }
 
   
-  unsigned m_r_start = size/2;
-  unsigned m_r_escape = 11 * m_r_start / 10;
-  unsigned m_bath_width = 2 * (m_r_escape + 2);
-  Matrix *bath = Matrix_create(m_bath_width);
-  CrystalModel *cm = CrystalModel_create(bath, m_r_start, m_r_escape);
+  Matrix *bath;
+  CrystalModel *cm = create_model(opts, &bath);
   CrystalView *cv = CrystalView_create(cm);
   CrystalControl *cc = CrystalControl_create(cm, cv);
+  CrystalControl_set_threads(cc, opts->threads);
   
   GtkBuilder *builder = gtk_builder_new();
   GError *error = NULL;
@@ -84,29 +396,135 @@ main(int argc,
      char *argv[])
 {
   int size = 0;
+  SimOptions opts; memset(&opts, 0, sizeof(opts));
+  opts.dim = 2;
   char mode[32]; memset(mode, 0, 32);
   for (int i = 1; i < argc; ++i) {
     if (strncmp("mode=", argv[i] , 5) == 0) {
       strncpy(mode, argv[i]+5, 32);
     } else if (strncmp(argv[i], "size=", 5) == 0) {
       size = atoi(argv[i] + 5);
+    } else if (strncmp(argv[i], "dim=", 4) == 0) {
+      opts.dim = atoi(argv[i] + 4);
+    } else if (strncmp(argv[i], "jumps=", 6) == 0) {
+      opts.long_jumps = atoi(argv[i] + 6);
+    } else if (strncmp(argv[i], "launch=", 7) == 0) {
+      opts.launch_mode = (strncmp("adaptive", argv[i] + 7, 8) == 0 ?
+			  CRYSTAL_LAUNCH_ADAPTIVE : CRYSTAL_LAUNCH_FIXED);
+      opts.launch_given = 1;
+    } else if (strncmp(argv[i], "escape=", 7) == 0) {
+      opts.escape_mode = (strncmp("return", argv[i] + 7, 6) == 0 ?
+			  CRYSTAL_ESCAPE_RETURN : CRYSTAL_ESCAPE_RELAUNCH);
+    } else if (strncmp(argv[i], "kernel=", 7) == 0) {
+      opts.kernel = (strncmp("batch", argv[i] + 7, 5) == 0 ? CRYSTAL_KERNEL_BATCH :
+		     strncmp("integer", argv[i] + 7, 7) == 0 ? CRYSTAL_KERNEL_INTEGER :
+		     CRYSTAL_KERNEL_SCALAR);
+    } else if (strncmp(argv[i], "lattice=", 8) == 0) {
+      if (strncmp("off", argv[i] + 8, 3) == 0) {
+	opts.lattice = CRYSTAL_LATTICE_OFF;
+      } else if (strncmp("square8", argv[i] + 8, 7) == 0) {
+	opts.lattice = CRYSTAL_LATTICE_SQUARE8;
+      } else if (strncmp("hex", argv[i] + 8, 3) == 0) {
+	opts.lattice = CRYSTAL_LATTICE_HEX;
+      } else {
+	opts.lattice = CRYSTAL_LATTICE_SQUARE;
+      }
+    } else if (strncmp(argv[i], "rule=", 5) == 0) {
+      /* rule=sticky:<p> or noise:<m>, without a value they grow as DLA does. */
+      char const *param = strchr(argv[i] + 5, ':');
+      opts.rule_param = param ? atof(param + 1) : 1;
+      if (strncmp("sticky", argv[i] + 5, 6) == 0) {
+	opts.rule = CRYSTAL_RULE_STICKY;
+      } else if (strncmp("noise", argv[i] + 5, 5) == 0) {
+	opts.rule = CRYSTAL_RULE_NOISE;
+      } else if (strncmp("ballistic", argv[i] + 5, 9) == 0) {
+	opts.rule = CRYSTAL_RULE_BALLISTIC;
+      } else if (strncmp("eden", argv[i] + 5, 4) == 0) {
+	opts.rule = CRYSTAL_RULE_EDEN;
+      } else {
+	opts.rule = CRYSTAL_RULE_DLA;
+      }
+    } else if (strncmp(argv[i], "threads=", 8) == 0) {
+      opts.threads = atoi(argv[i] + 8);
+    } else if (strncmp(argv[i], "bath=", 5) == 0) {
+      if (strncmp("bits", argv[i] + 5, 4) == 0) {
+	opts.layout = MATRIX_LAYOUT_BITS;
+      } else if (strncmp("tiled", argv[i] + 5, 5) == 0) {
+	opts.layout = MATRIX_LAYOUT_TILED;
+      } else if (strncmp("sparse", argv[i] + 5, 6) == 0) {
+	opts.layout = MATRIX_LAYOUT_SPARSE;
+      } else {
+	opts.layout = MATRIX_LAYOUT_BYTES;
+      }
+    } else if (strncmp(argv[i], "checkpoint=", 11) == 0) {
+      opts.checkpoint = argv[i] + 11;
+    } else if (strncmp(argv[i], "checkpoint_ions=", 16) == 0) {
+      opts.checkpoint_ions = atoi(argv[i] + 16);
+    } else if (strncmp(argv[i], "checkpoint_secs=", 16) == 0) {
+      opts.checkpoint_secs = atoi(argv[i] + 16);
+    } else if (strncmp(argv[i], "resume=", 7) == 0) {
+      opts.resume = argv[i] + 7;
+    } else if (strncmp(argv[i], "output=", 7) == 0) {
+      /* <format>[:<file>], standard output without a file */
+      char format[16]; memset(format, 0, 16);
+      char const *colon = strchr(argv[i] + 7, ':');
+      size_t const n = colon ? (size_t)(colon - (argv[i] + 7)) : strlen(argv[i] + 7);
+      strncpy(format, argv[i] + 7, n < 15 ? n : 15);
+      if (CrystalWriter_parse_format(format, &opts.output_format)) {
+	fprintf(stderr, "Unknown output format '%s'\n", format);
+	return EXIT_FAILURE;
+      }
+      opts.output = colon ? colon + 1 : NULL;
+    } else if (strncmp(argv[i], "frames=", 7) == 0) {
+      opts.frames = atoi(argv[i] + 7);
+    } else if (strncmp(argv[i], "sizes=", 6) == 0) {
+      opts.n_sizes = parse_sizes(argv[i] + 6, opts.sizes);
+    } else if (strncmp(argv[i], "seeds=", 6) == 0) {
+      opts.n_seeds = parse_seeds(argv[i] + 6, opts.seeds);
+    } else if (strncmp(argv[i], "factors=", 8) == 0) {
+      opts.n_factors = parse_factors(argv[i] + 8, opts.factors);
+    } else if (strncmp(argv[i], "results=", 8) == 0) {
+      opts.results = argv[i] + 8;
     }
   }
   if (strlen(mode) == 0) {
     strncpy(mode, "cli", 32);
-    printf("INFO: mode has been set to '%s'\n", mode);
+    fprintf(stderr, "INFO: mode has been set to '%s'\n", mode);
   }
   if (size < 20) {
     size = 20;
-    printf("INFO: size has been set to '%d'\n", size);
+    fprintf(stderr, "INFO: size has been set to '%d'\n", size);
+  }
+  opts.size = size;
+  if (opts.frames && !opts.output) {
+    fprintf(stderr, "frames needs an output file\n");
+    return EXIT_FAILURE;
+  }
+  if (opts.dim != 2 && opts.dim != 3) {
+    fprintf(stderr, "dim=%u is not supported, only 2 and 3\n", opts.dim);
+    return EXIT_FAILURE;
+  }
+  if (opts.dim == 3 && strncmp("cli", mode, 3) != 0) {
+    fprintf(stderr, "dim=3 is only supported with mode=cli\n");
+    return EXIT_FAILURE;
   }
   
-  if (strncmp("cli", mode, 3) == 0) {
-    return cli_sim(size);
+  if (strncmp("cli", mode, 3) == 0 && opts.dim == 3) {
+    return cli_sim_3d(&opts);
+  } else if (strncmp("cli", mode, 3) == 0) {
+    return cli_sim(&opts);
   } else if (strncmp("gui", mode, 3) == 0) {
-    return gui_sim(argc-2, argv, size);
+    return gui_sim(argc-2, argv, &opts);
+  } else if (strncmp("ensemble", mode, 8) == 0) {
+    return ensemble_sim(&opts);
+  } else if (strncmp("bench", mode, 5) == 0) {
+    Benchmark_kernels(opts.size, 0, stdout);
+    Benchmark_threads(opts.size, 0,
+		      opts.threads > 0 ? opts.threads : sysconf(_SC_NPROCESSORS_ONLN),
+		      stdout);
+    Benchmark_layouts(0, stdout);
   } else {
-    printf("usage: '%s mode=[cli/gui] size=[<value>]'\n", argv[0]);
+    printf("usage: '%s mode=[cli/gui/bench/ensemble] size=[<value>] dim=[2/3] jumps=[0/1] launch=[fixed/adaptive] escape=[relaunch/return] kernel=[scalar/batch/integer] lattice=[square/square8/hex/off] rule=[dla/sticky:<p>/noise:<m>/ballistic/eden] threads=[<value>] bath=[bytes/bits/tiled/sparse] checkpoint=[<file>] checkpoint_ions=[<value>] checkpoint_secs=[<value>] resume=[<file>] output=[txt/pbm/pgm/png/points/age/discs][:<file>] frames=[<value>] sizes=[<value>,...] seeds=[<first>-<last>,...] factors=[<value>,...] results=[<file>]'\n", argv[0]);
   }
   return EXIT_SUCCESS;
 }
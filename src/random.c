@@ -0,0 +1,90 @@
+#include "random.h"
+
+static uint64_t
+splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+extern void
+cs_rand_seed(CsRandom *rng,
+	     uint64_t seed)
+{
+  for (int i = 0; i < 4; ++i) {
+    rng->s[i] = splitmix64(&seed);
+  }
+}
+
+/*
+ * Seeds a generator for stream number `stream` of `seed` in O(1), for
+ * when streams are needed out of order (e.g. one per ion). Reaching
+ * stream n by jumps would take n of them.
+ */
+extern void
+cs_rand_seed_stream(CsRandom *rng,
+		    uint64_t seed,
+		    uint64_t stream)
+{
+  uint64_t x = stream;
+  cs_rand_seed(rng, seed ^ splitmix64(&x));
+}
+
+/* Advances the generator by 2^128 steps. */
+extern void
+cs_rand_jump(CsRandom *rng)
+{
+  static uint64_t const jump[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+				   0xa9582618e03fc9aa, 0x39abdc4529b1661c };
+  uint64_t s[4] = { 0, 0, 0, 0 };
+
+  for (int i = 0; i < 4; ++i) {
+    for (int b = 0; b < 64; ++b) {
+      if (jump[i] & (UINT64_C(1) << b)) {
+	for (int k = 0; k < 4; ++k) {
+	  s[k] ^= rng->s[k];
+	}
+      }
+      cs_rand(rng);
+    }
+  }
+  for (int k = 0; k < 4; ++k) {
+    rng->s[k] = s[k];
+  }
+}
+
+/*
+ * Hands the current stream to `child` and moves `rng` 2^128 steps
+ * ahead, so repeated splits give non-overlapping streams.
+ */
+extern void
+cs_rand_split(CsRandom *rng,
+	      CsRandom *child)
+{
+  *child = *rng;
+  cs_rand_jump(rng);
+}
+
+/* Fills `dirs` with n values in [0, 4), 32 per 64-bit draw. */
+extern void
+cs_rand_fill_directions(CsRandom *rng,
+			unsigned char *dirs,
+			size_t n)
+{
+  while (n >= 32) {
+    uint64_t w = cs_rand(rng);
+    for (int i = 0; i < 32; ++i, w >>= 2) {
+      *dirs++ = w & 3;
+    }
+    n -= 32;
+  }
+  if (n > 0) {
+    uint64_t w = cs_rand(rng);
+    while (n-- > 0) {
+      *dirs++ = w & 3;
+      w >>= 2;
+    }
+  }
+}
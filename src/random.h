@@ -2,11 +2,65 @@
 #define RANDOM_H_
 
 #include <inttypes.h>
+#include <stddef.h>
 
-#define CS_RAND_MAX 0x7fff
-static uint_fast16_t __cs_next_rand__ = 1;
-#define cs_rand() (((__cs_next_rand__ = __cs_next_rand__*0x41c64e6d + 0x3039) >> 16) & 0x7fff)
-#define cs_drand() (cs_rand() / (double)0x8000)
-#define cs_srand(seed) (__cs_next_rand__ = seed)
+/*
+ * xoshiro256** generator with explicit state. Every model owns one so
+ * runs are reproducible per seed. Streams handed out in order with
+ * cs_rand_split() never overlap. cs_rand_seed_stream() reaches any
+ * stream by number at once, as the per-ion streams that keep parallel
+ * growth identical to serial growth need, but only hashes the seed, so
+ * its streams are independent in practice without being provably apart.
+ */
+typedef struct
+{
+  uint64_t s[4];
+} CsRandom;
+
+extern void
+cs_rand_seed(CsRandom *rng,
+	     uint64_t seed);
+extern void
+cs_rand_seed_stream(CsRandom *rng,
+		    uint64_t seed,
+		    uint64_t stream);
+extern void
+cs_rand_jump(CsRandom *rng);
+extern void
+cs_rand_split(CsRandom *rng,
+	      CsRandom *child);
+extern void
+cs_rand_fill_directions(CsRandom *rng,
+			unsigned char *dirs,
+			size_t n);
+
+static inline uint64_t
+cs_rotl(uint64_t x,
+	int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t
+cs_rand(CsRandom *rng)
+{
+  uint64_t *s = rng->s;
+  uint64_t const result = cs_rotl(s[1] * 5, 7) * 9;
+  uint64_t const t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = cs_rotl(s[3], 45);
+  return result;
+}
+
+/* Uniform in [0, 1) with 53 bits of precision. */
+static inline double
+cs_drand(CsRandom *rng)
+{
+  return (cs_rand(rng) >> 11) * 0x1.0p-53;
+}
 
 #endif //RANDOM_H_